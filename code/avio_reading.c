@@ -29,47 +29,163 @@
  * @example avio_reading.c
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
-#include <libavutil/file.h>X
+#include <libavutil/file.h>
+#include <libavutil/time.h>
+
+#include "core/avio_cache.h"
+
+/* default size of the AVIOContext buffer, -bufsize overrides it */
+#define AVIO_BUFFER_SIZE 32768
+/* -cache: shared block cache size and block size */
+#define CACHE_SIZE (16 << 20)
+#define CACHE_BLOCK_SIZE 65536
 
 struct buffer_data {
-    uint8_t *ptr;
-    size_t size; ///< size left in the buffer
+    uint8_t *base;
+    size_t size; ///< size of the mapped file
+    size_t pos;  ///< current read position
 };
 
+/* called for every AVIO buffer refill, so no logging here. The one memcpy is
+ * the price of going through AVIOContext, which reads into its own buffer */
 static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
     struct buffer_data *bd = (struct buffer_data *) opaque;
-    buf_size = FFMIN(buf_size, bd->size);
+    size_t left = bd->size - bd->pos;
 
+    buf_size = FFMIN((size_t) buf_size, left);
     if (!buf_size)
         return AVERROR_EOF;
-    printf("ptr:%p size:%zu\n", bd->ptr, bd->size);
 
     /* copy internal buffer data to buf */
-    memcpy(buf, bd->ptr, buf_size);
-    bd->ptr += buf_size;
-    bd->size -= buf_size;
+    memcpy(buf, bd->base + bd->pos, buf_size);
+    bd->pos += buf_size;
 
     return buf_size;
 }
 
-int main() {
+/* lets the demuxers jump to trailing indexes (moov at the end, ID3v1, ...)
+ * instead of reading the whole file to get there */
+static int64_t seek_packet(void *opaque, int64_t offset, int whence) {
+    struct buffer_data *bd = (struct buffer_data *) opaque;
+    int64_t pos;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return bd->size;
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = bd->pos + offset;
+            break;
+        case SEEK_END:
+            pos = bd->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > (int64_t) bd->size)
+        return AVERROR(EINVAL);
+    bd->pos = pos;
+    return pos;
+}
+
+/* open the input several times through one shared block cache, the way a
+ * probe, a thumbnail and a transcode job would, demuxing it fully each time */
+static int run_cached(const char *input_filename, int passes, int buffer_size) {
+    AVIOCache *cache;
+    AVFormatContext *fmt_ctx = NULL;
+    AVIOContext *avio_ctx = NULL;
+    AVPacket pkt;
+    int64_t start;
+    int i, ret = 0;
+
+    cache = avio_cache_alloc(CACHE_SIZE, CACHE_BLOCK_SIZE);
+    if (!cache)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < passes && ret >= 0; i++) {
+        start = av_gettime_relative();
+        if ((ret = avio_cache_open(&avio_ctx, cache, input_filename, buffer_size)) < 0)
+            break;
+        if (!(fmt_ctx = avformat_alloc_context())) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        fmt_ctx->pb = avio_ctx;
+        fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+        ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL);
+        if (ret >= 0)
+            ret = avformat_find_stream_info(fmt_ctx, NULL);
+        while (ret >= 0 && (ret = av_read_frame(fmt_ctx, &pkt)) >= 0)
+            av_packet_unref(&pkt);
+        if (ret == AVERROR_EOF)
+            ret = 0;
+        printf("pass %d: %.3f ms\n", i + 1, (av_gettime_relative() - start) / 1000.0);
+
+        avformat_close_input(&fmt_ctx);
+        avio_cache_close(&avio_ctx);
+    }
+
+    avformat_close_input(&fmt_ctx);
+    avio_cache_close(&avio_ctx);
+    avio_cache_dump(cache, stdout);
+    avio_cache_free(&cache);
+    return ret;
+}
+
+int main(int argc, char **argv) {
     AVFormatContext *fmt_ctx = NULL;
     AVIOContext *avio_ctx = NULL;
     uint8_t *buffer = NULL, *avio_ctx_buffer = NULL;
-    size_t buffer_size, avio_ctx_buffer_size = 4096;
+    size_t buffer_size = 0, avio_ctx_buffer_size = AVIO_BUFFER_SIZE;
     char *input_filename = "../origin.aac";
-    int ret = 0;
+    int64_t start;
+    int i, ret = 0;
+    int cache_passes = 0;
     struct buffer_data bd = {0};
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-bufsize") && i + 1 < argc) {
+            avio_ctx_buffer_size = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+            cache_passes = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-bufsize N] [-cache PASSES] [input_file]\n"
+                            "-bufsize sets the AVIOContext buffer size (default %d).\n"
+                            "-cache opens and demuxes the file PASSES times through a shared\n"
+                            "       block cache and prints its hit rate.\n",
+                    argv[0], AVIO_BUFFER_SIZE);
+            return 1;
+        } else {
+            input_filename = argv[i];
+        }
+    }
+    if (!avio_ctx_buffer_size || avio_ctx_buffer_size > INT_MAX) {
+        fprintf(stderr, "Invalid buffer size\n");
+        return 1;
+    }
+
+    if (cache_passes > 0) {
+        ret = run_cached(input_filename, cache_passes, avio_ctx_buffer_size);
+        goto end;
+    }
+
     /* slurp file content into buffer */
     ret = av_file_map(input_filename, &buffer, &buffer_size, 0, NULL);
     if (ret < 0)
         goto end;
 
     /* fill opaque structure used by the AVIOContext read callback */
-    bd.ptr = buffer;
+    bd.base = buffer;
     bd.size = buffer_size;
 
     if (!(fmt_ctx = avformat_alloc_context())) {
@@ -83,13 +199,14 @@ int main() {
         goto end;
     }
     avio_ctx = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size,
-                                  0, &bd, &read_packet, NULL, NULL);
+                                  0, &bd, &read_packet, NULL, &seek_packet);
     if (!avio_ctx) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
     fmt_ctx->pb = avio_ctx;
 
+    start = av_gettime_relative();
     ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL);
     if (ret < 0) {
         fprintf(stderr, "Could not open input\n");
@@ -103,6 +220,9 @@ int main() {
     }
 
     av_dump_format(fmt_ctx, 0, input_filename, 0);
+    printf("open + find_stream_info: %.3f ms, %"PRId64" of %zu bytes read, buffer %zu\n",
+           (av_gettime_relative() - start) / 1000.0, avio_ctx->bytes_read,
+           buffer_size, avio_ctx_buffer_size);
 
     end:
     avformat_close_input(&fmt_ctx);
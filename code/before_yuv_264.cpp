@@ -1,42 +1,370 @@
 #include <string>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
 
 extern "C"
 {
 #include <libavutil/opt.h>
+#include <libavutil/time.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include "libavutil/imgutils.h"
+#include "core/avio_async_writer.h"
+#include "core/yuv_frame_source.h"
+#include "core/stage_timer.h"
 };
 
-int main() {
+//输出在单独的线程里写, 缓冲区大小和个数
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFERS     2
+
+//GOP分段: 每段是一个独立的编码器实例编出来的闭合GOP, packet先存在内存里
+struct Chunk {
+    int first_frame = 0;
+    int nb_frames = 0;
+    std::vector<AVPacket *> packets;
+    int ret = 0;
+    bool done = false;
+};
+
+//分段并行编码的共享状态, lock保护next_chunk/written/abort和各段的done/ret
+struct ChunkEncoder {
+    const char *in_file = nullptr;
+    AVCodecID codec_id = AV_CODEC_ID_H265;
+    int in_w = 0, in_h = 0;
+    std::vector<Chunk> chunks;
+    int next_chunk = 0;     //下一个要编码的分段
+    int written = 0;        //已经写到文件里的分段数
+    int window = 0;         //最多领先写文件多少段, 限制内存里的packet
+    bool abort = false;
+    std::mutex lock;
+    std::condition_variable cond;
+};
+
+//按原来的参数打开编码器. single_thread时编码器内部不再开线程, 并行度来自分段
+static AVCodecContext *open_encoder(AVCodecID codec_id, int in_w, int in_h, int gop_size, bool single_thread) {
+    AVCodec *pCodec = avcodec_find_encoder(codec_id);
+    AVCodecContext *pCodecCtx;
+    AVDictionary *param = nullptr;
+    int ret;
+
+    if (!pCodec) {
+        printf("Can not find encoder! \n");
+        return nullptr;
+    }
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (!pCodecCtx)
+        return nullptr;
+    pCodecCtx->codec_type = AVMEDIA_TYPE_VIDEO;
+    pCodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+    pCodecCtx->width = in_w;
+    pCodecCtx->height = in_h;
+    pCodecCtx->bit_rate = 400000;
+    pCodecCtx->gop_size = gop_size;
+    pCodecCtx->time_base.num = 1;
+    pCodecCtx->time_base.den = 25;
+    //H264
+    //pCodecCtx->me_range = 16;
+    //pCodecCtx->max_qdiff = 4;
+    //pCodecCtx->qcompress = 0.6;
+    pCodecCtx->qmin = 10;
+    pCodecCtx->qmax = 51;
+    //Optional Param
+    pCodecCtx->max_b_frames = 3;
+    //H.264
+    if (codec_id == AV_CODEC_ID_H264) {
+        av_dict_set(&param, "preset", "slow", 0);
+        av_dict_set(&param, "tune", "zerolatency", 0);
+        //av_dict_set(¶m, "profile", "main", 0);
+        if (single_thread)
+            pCodecCtx->thread_count = 1;
+    }
+    //H.265
+    if (codec_id == AV_CODEC_ID_H265) {
+        av_dict_set(&param, "preset", "ultrafast", 0);
+        av_dict_set(&param, "tune", "zero-latency", 0);
+        if (single_thread)
+            av_dict_set(&param, "x265-params", "pools=none:frame-threads=1", 0);
+    }
+    ret = avcodec_open2(pCodecCtx, pCodec, &param);
+    av_dict_free(&param);
+    if (ret < 0) {
+        printf("Failed to open encoder! \n");
+        avcodec_free_context(&pCodecCtx);
+    }
+    return pCodecCtx;
+}
+
+//把编码器输出的packet全部写入文件
+static int write_packets(AVCodecContext *pCodecCtx, AVFormatContext *pFormatCtx, AVStream *video_st, AVPacket *pkt) {
+    int ret;
+    while ((ret = timed_receive_packet(pCodecCtx, pkt)) >= 0) {
+        pkt->stream_index = video_st->index;
+        av_packet_rescale_ts(pkt, pCodecCtx->time_base, video_st->time_base);
+        ret = timed_write_frame(pFormatCtx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+//把编码器输出的packet存到分段里, 由写文件的线程按顺序写出
+static int collect_packets(AVCodecContext *pCodecCtx, AVPacket *pkt, Chunk *chunk) {
+    int ret;
+    while ((ret = timed_receive_packet(pCodecCtx, pkt)) >= 0) {
+        AVPacket *out = av_packet_alloc();
+        if (!out) {
+            av_packet_unref(pkt);
+            return AVERROR(ENOMEM);
+        }
+        av_packet_move_ref(out, pkt);
+        chunk->packets.push_back(out);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+//用新的编码器实例编码一个分段, 第一帧一定是IDR, 参数集(SPS/PPS/VPS)带在码流里
+static int encode_chunk(ChunkEncoder *ce, Chunk *chunk) {
+    AVCodecContext *pCodecCtx = open_encoder(ce->codec_id, ce->in_w, ce->in_h, chunk->nb_frames, true);
+    YUVFrameSource *yuv_src = nullptr;
+    AVFrame *pFrame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!pCodecCtx || !pFrame || !pkt)
+        goto end;
+    //每个分段自己打开输入文件, 从分段的第一帧开始读
+    yuv_src = yuv_frame_source_open(ce->in_file, pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height, 64);
+    if (!yuv_src) {
+        ret = AVERROR(EIO);
+        goto end;
+    }
+    if ((ret = yuv_frame_source_seek(yuv_src, chunk->first_frame)) < 0)
+        goto end;
+
+    for (int i = 0; i < chunk->nb_frames; i++) {
+        ret = yuv_frame_source_read(yuv_src, pFrame);
+        if (ret == AVERROR_EOF)
+            break;
+        else if (ret < 0)
+            goto end;
+        //PTS用整个文件里的帧序号, 拼接后不用再改
+        pFrame->pts = chunk->first_frame + i;
+        ret = timed_send_frame(pCodecCtx, pFrame);
+        av_frame_unref(pFrame);
+        if (ret < 0 || (ret = collect_packets(pCodecCtx, pkt, chunk)) < 0)
+            goto end;
+    }
+    //Flush encoder
+    ret = timed_send_frame(pCodecCtx, nullptr);
+    if (ret >= 0)
+        ret = collect_packets(pCodecCtx, pkt, chunk);
+
+    end:
+    avcodec_free_context(&pCodecCtx);
+    av_frame_free(&pFrame);
+    av_packet_free(&pkt);
+    yuv_frame_source_close(&yuv_src);
+    return ret;
+}
+
+static void chunk_worker(ChunkEncoder *ce) {
+    for (;;) {
+        Chunk *chunk;
+        {
+            std::unique_lock<std::mutex> lk(ce->lock);
+            ce->cond.wait(lk, [ce] {
+                return ce->abort || ce->next_chunk >= (int) ce->chunks.size() ||
+                       ce->next_chunk < ce->written + ce->window;
+            });
+            if (ce->abort || ce->next_chunk >= (int) ce->chunks.size())
+                return;
+            chunk = &ce->chunks[ce->next_chunk++];
+        }
+        int ret = encode_chunk(ce, chunk);
+        {
+            std::lock_guard<std::mutex> lk(ce->lock);
+            chunk->ret = ret;
+            chunk->done = true;
+        }
+        ce->cond.notify_all();
+    }
+}
+
+//按分段顺序写文件. 各段的编码延迟相同, dts本来就是递增的. 延迟不同时dts会和前一段重叠,
+//这时把这一段和后面所有段的pts/dts整体后移, 单独改某个packet的dts会出现dts > pts
+static int write_chunks(ChunkEncoder *ce, AVFormatContext *pFormatCtx, AVStream *video_st, AVRational time_base) {
+    int64_t last_dts = AV_NOPTS_VALUE, shift = 0;
+    int ret = 0;
+
+    for (size_t i = 0; i < ce->chunks.size() && ret >= 0; i++) {
+        Chunk *chunk = &ce->chunks[i];
+        {
+            std::unique_lock<std::mutex> lk(ce->lock);
+            ce->cond.wait(lk, [chunk] { return chunk->done; });
+        }
+        ret = chunk->ret;
+        int64_t min_dts = INT64_MAX;
+        for (AVPacket *pkt : chunk->packets)
+            if (pkt->dts != AV_NOPTS_VALUE)
+                min_dts = std::min(min_dts, pkt->dts);
+        if (last_dts != AV_NOPTS_VALUE && min_dts != INT64_MAX && min_dts + shift <= last_dts) {
+            shift = last_dts + 1 - min_dts;
+            printf("chunk %d overlaps the previous one, timestamps shifted by %" PRId64 " frame(s)\n",
+                   (int) i, shift);
+        }
+        for (AVPacket *pkt : chunk->packets) {
+            if (ret >= 0) {
+                if (pkt->pts != AV_NOPTS_VALUE)
+                    pkt->pts += shift;
+                if (pkt->dts != AV_NOPTS_VALUE) {
+                    pkt->dts += shift;
+                    last_dts = pkt->dts;
+                }
+                pkt->stream_index = video_st->index;
+                av_packet_rescale_ts(pkt, time_base, video_st->time_base);
+                ret = timed_write_frame(pFormatCtx, pkt);
+            }
+            av_packet_free(&pkt);
+        }
+        chunk->packets.clear();
+        {
+            std::lock_guard<std::mutex> lk(ce->lock);
+            ce->written = (int) i + 1;
+            if (ret < 0)
+                ce->abort = true;
+        }
+        ce->cond.notify_all();
+    }
+    return ret;
+}
+
+//分段并行编码: 输入按gop_size切成闭合GOP, nb_threads个编码器同时编码, 按顺序拼接
+static int encode_chunked(const char *in_file, AVCodecID codec_id, int in_w, int in_h, int framenum,
+                          int gop_size, int nb_threads, AVFormatContext *pFormatCtx, AVStream *video_st) {
+    ChunkEncoder ce;
+    std::vector<std::thread> workers;
+    AVRational time_base = {1, 25};
+    int ret;
+
+    ce.in_file = in_file;
+    ce.codec_id = codec_id;
+    ce.in_w = in_w;
+    ce.in_h = in_h;
+    ce.window = 2 * nb_threads;
+    for (int first = 0; first < framenum; first += gop_size) {
+        Chunk chunk;
+        chunk.first_frame = first;
+        chunk.nb_frames = std::min(gop_size, framenum - first);
+        ce.chunks.push_back(chunk);
+    }
+
+    for (int i = 0; i < nb_threads; i++)
+        workers.emplace_back(chunk_worker, &ce);
+    ret = write_chunks(&ce, pFormatCtx, video_st, time_base);
+    for (std::thread &t : workers)
+        t.join();
+
+    //出错时没写出去的packet
+    for (Chunk &chunk : ce.chunks)
+        for (AVPacket *pkt : chunk.packets)
+            av_packet_free(&pkt);
+    return ret;
+}
+
+static void usage(const char *name) {
+    printf("usage: %s [-threads N] [-gop N] [-frames N] [-codec h264|hevc|h265] [-s WxH] [input.yuv [output]]\n"
+           "  -threads N   encode N GOP chunks in parallel, each on its own encoder (0 = one per core)\n"
+           "  -gop N       frames per chunk, every chunk is a closed GOP (default 250,\n"
+           "               with -threads frames / threads so that every thread gets a chunk)\n"
+           "  -frames N    frames to encode (default 100)\n", name);
+}
+
+int main(int argc, char **argv) {
     AVFormatContext *pFormatCtx;
     AVOutputFormat *fmt;
     AVStream *video_st;
-    AVCodecContext *pCodecCtx = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_H265));;
-    AVCodec *pCodec;
+    AVCodecContext *pCodecCtx;
+    AVCodecID codec_id = AV_CODEC_ID_H265;
     AVPacket pkt;
-    uint8_t *picture_buf;
     AVFrame *pFrame;
-    int picture_size;
-    int y_size;
+    YUVFrameSource *yuv_src;
+    int ret;
     //获取yuv文件
-    FILE *in_file = fopen(R"(C:\Users\user\Desktop\LearnFFmpeg\ds_480x272.yuv)", "rb");
+    const char *in_file = R"(C:\Users\user\Desktop\LearnFFmpeg\ds_480x272.yuv)";
     int in_w = 480, in_h = 272;                              //Input data's width and height
     int framenum = 100;                                   //Frames to encode
+    int gop_size = 0;                                     //0: 默认值, 见下面
+    int nb_threads = 1;
+    int nb_inputs = 0;
     //const char* out_file = "src01.h264";              //Output Filepath
     //const char* out_file = "src01.ts";
 //    const char* out_file = "ds.hevc";
     const char *out_file = R"(C:\Users\user\Desktop\LearnFFmpeg\ds.hevc)";
 
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            nb_threads = atoi(argv[++i]);
+            if (nb_threads <= 0)
+                nb_threads = std::max(1u, std::thread::hardware_concurrency());
+        } else if (!strcmp(argv[i], "-gop") && i + 1 < argc) {
+            gop_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+            framenum = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-codec") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "h264")) {
+                codec_id = AV_CODEC_ID_H264;
+            } else if (!strcmp(argv[i], "hevc") || !strcmp(argv[i], "h265")) {
+                codec_id = AV_CODEC_ID_H265;
+            } else {
+                fprintf(stderr, "Unknown codec '%s'\n", argv[i]);
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &in_w, &in_h) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (argv[i][0] != '-' && nb_inputs < 2) {
+            if (nb_inputs++ == 0)
+                in_file = argv[i];
+            else
+                out_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (gop_size < 0 || framenum <= 0 || in_w <= 0 || in_h <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    //没给-gop时, 分段编码按线程数平分, 否则默认的250帧一段在100帧里只有一段, 等于串行编码
+    if (!gop_size)
+        gop_size = nb_threads > 1 ? (framenum + nb_threads - 1) / nb_threads : 250;
+    if (nb_threads > 1 && (framenum + gop_size - 1) / gop_size < nb_threads)
+        printf("only %d chunk(s) of %d frames for %d threads, some threads stay idle\n",
+               (framenum + gop_size - 1) / gop_size, gop_size, nb_threads);
+
     pFormatCtx = avformat_alloc_context();
     //Guess Format
     fmt = av_guess_format(nullptr, out_file, nullptr);
     //设置输出格式（h264）
     pFormatCtx->oformat = fmt;
 
-    //Open output URL
-    if (avio_open(&pFormatCtx->pb, out_file, AVIO_FLAG_WRITE) < 0) {
+    //Open output URL, 码流在单独的线程里写文件, 编码线程不等磁盘
+    if (avio_async_writer_open(&pFormatCtx->pb, out_file, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFERS) < 0) {
         printf("Failed to open output file! \n");
         return -1;
     }
@@ -46,91 +374,82 @@ int main() {
     }
     //这三个参数必须设置
     video_st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    video_st->codecpar->codec_id = codec_id;
     video_st->codecpar->width = in_w;
     video_st->codecpar->height = in_h;
-    pCodecCtx->codec_type = video_st->codecpar->codec_type;
-    pCodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
-    pCodecCtx->width = video_st->codecpar->width;
-    pCodecCtx->height = video_st->codecpar->height;
-    pCodecCtx->bit_rate = 400000;
-    pCodecCtx->gop_size = 250;
-    pCodecCtx->time_base.num = 1;
-    pCodecCtx->time_base.den = 25;
-    //H264
-    //pCodecCtx->me_range = 16;
-    //pCodecCtx->max_qdiff = 4;
-    //pCodecCtx->qcompress = 0.6;
-    pCodecCtx->qmin = 10;
-    pCodecCtx->qmax = 51;
-    //Optional Param
-    pCodecCtx->max_b_frames = 3;
-    // Set Option
-    AVDictionary *param = nullptr;
-    //H.264
-    if (pCodecCtx->codec_id == AV_CODEC_ID_H264) {
-        av_dict_set(&param, "preset", "slow", 0);
-        av_dict_set(&param, "tune", "zerolatency", 0);
-        //av_dict_set(¶m, "profile", "main", 0);
-    }
-    //H.265
-    if (pCodecCtx->codec_id == AV_CODEC_ID_H265) {
-        av_dict_set(&param, "preset", "ultrafast", 0);
-        av_dict_set(&param, "tune", "zero-latency", 0);
-    }
+    video_st->time_base = {1, 25};
     //Show some Information
     av_dump_format(pFormatCtx, 0, out_file, 1);
-    pCodec = avcodec_find_encoder(pCodecCtx->codec_id);
-    if (!pCodec) {
-        printf("Can not find encoder! \n");
-        return -1;
-    }
-    if (avcodec_open2(pCodecCtx, pCodec, &param) < 0) {
-        printf("Failed to open encoder! \n");
-        return -1;
-    }
-    pFrame = av_frame_alloc();
-    picture_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, pCodecCtx->width, pCodecCtx->height, 1);
-    picture_buf = (uint8_t *) av_malloc(picture_size);
-    av_image_fill_arrays(pFrame->data, pFrame->linesize, picture_buf, pCodecCtx->pix_fmt, pCodecCtx->width,
-                         pCodecCtx->height, 1);
-    //Write File Header
-    avformat_write_header(pFormatCtx, nullptr);
-    av_new_packet(&pkt, picture_size);
-
-    y_size = pCodecCtx->width * pCodecCtx->height;
-
-    for (int i = 0; i < framenum; i++) {
-        //Read raw YUV data
-        if (fread(picture_buf, 1, y_size * 3 / 2, in_file) <= 0) {
-            printf("Failed to read raw data! \n");
+
+    int64_t start = av_gettime_relative();
+    if (nb_threads > 1) {
+        //Write File Header
+        if (avformat_write_header(pFormatCtx, nullptr) < 0) {
+            printf("Failed to write header! \n");
             return -1;
-        } else if (feof(in_file)) {
-            break;
         }
-        pFrame->data[0] = picture_buf;              // Y
-        pFrame->data[1] = picture_buf + y_size;      // U
-        pFrame->data[2] = picture_buf + y_size * 5 / 4;  // V
-        //PTS
-        //pFrame->pts=i;
-        //25 位fps
-        pFrame->pts = i * (video_st->time_base.den) / ((video_st->time_base.num) * 25);
-        //Encode
-        avcodec_send_frame(pCodecCtx, pFrame);
-        avcodec_receive_packet(pCodecCtx, &pkt);
-        pkt.stream_index = video_st->index;
-        //写数据
-        av_write_frame(pFormatCtx, &pkt);
-        av_packet_unref(&pkt);
+        if (encode_chunked(in_file, codec_id, in_w, in_h, framenum, gop_size, nb_threads,
+                           pFormatCtx, video_st) < 0) {
+            printf("Failed to encode frame! \n");
+            return -1;
+        }
+    } else {
+        pCodecCtx = open_encoder(codec_id, in_w, in_h, gop_size, false);
+        if (!pCodecCtx)
+            return -1;
+        pFrame = av_frame_alloc();
+        //每帧读到单独的缓冲池buffer里，编码器lookahead持有的帧不会被覆盖
+        yuv_src = yuv_frame_source_open(in_file, pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height, 64);
+        if (!yuv_src) {
+            printf("Failed to open input file! \n");
+            return -1;
+        }
+        //Write File Header
+        if (avformat_write_header(pFormatCtx, nullptr) < 0) {
+            printf("Failed to write header! \n");
+            return -1;
+        }
+        av_init_packet(&pkt);
+        pkt.data = nullptr;
+        pkt.size = 0;
+
+        for (int i = 0; i < framenum; i++) {
+            //Read raw YUV data
+            ret = yuv_frame_source_read(yuv_src, pFrame);
+            if (ret == AVERROR_EOF) {
+                break;
+            } else if (ret < 0) {
+                printf("Failed to read raw data! \n");
+                return -1;
+            }
+            //PTS, 25fps
+            pFrame->pts = i;
+            //Encode
+            ret = timed_send_frame(pCodecCtx, pFrame);
+            av_frame_unref(pFrame);
+            //写数据
+            if (ret < 0 || write_packets(pCodecCtx, pFormatCtx, video_st, &pkt) < 0) {
+                printf("Failed to encode frame! \n");
+                return -1;
+            }
+        }
+        //Flush encoder
+        if (timed_send_frame(pCodecCtx, nullptr) < 0 || write_packets(pCodecCtx, pFormatCtx, video_st, &pkt) < 0) {
+            printf("Failed to flush encoder! \n");
+            return -1;
+        }
+        avcodec_free_context(&pCodecCtx);
+        av_frame_free(&pFrame);
+        yuv_frame_source_close(&yuv_src);
     }
     //Write file trailer
     av_write_trailer(pFormatCtx);
+    printf("encoded with %d thread(s) in %.3f s\n", nb_threads, (av_gettime_relative() - start) / 1e6);
     //Clean
-    avcodec_free_context(&pCodecCtx);
-    av_free(pFrame);
-    av_free(picture_buf);
-    avio_close(pFormatCtx->pb);
+    if (avio_async_writer_close(&pFormatCtx->pb) < 0) {
+        printf("Failed to write output file! \n");
+        return -1;
+    }
     avformat_free_context(pFormatCtx);
-    fclose(in_file);
     return 0;
 }
-
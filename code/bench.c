@@ -0,0 +1,651 @@
+/**
+ * @file
+ * Benchmark suite over the bundled sample media.
+ *
+ * Runs decode (H.264, HEVC, AAC, keyframe-only H.264/HEVC), encode (H.264,
+ * H.265, AAC), filtering and muxing scenarios on ds.264, ds.hevc and
+ * origin.aac, repeats each of them and prints median/p95 wall time, frames/s
+ * and bytes/s as JSON, so results can be compared across library upgrades.
+ * The split scenarios only cut the H.264/HEVC streams into access units, with
+ * the parser and with the Annex B splitter.
+ *
+ * usage: bench [-repeat N] [-media DIR] [-o FILE] [scenario...]
+ * @example bench.c
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/avutil.h>
+#include <libavutil/file.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+
+#include "core/annexb.h"
+
+#define DEFAULT_REPEAT 5
+#define MAX_REPEAT 1000
+#define FILTER_DESCR "scale=iw/2:ih/2,hflip"
+/* passes over the sample stream per split run, one pass takes well under 1 ms */
+#define SPLIT_PASSES 100
+
+/* an input file, copied into a padded buffer so the parsers can run on it */
+typedef struct MediaFile {
+    const char *name;
+    char path[1024];
+    uint8_t *data;
+    size_t size;
+} MediaFile;
+
+typedef struct BenchContext {
+    const char *media_dir;
+    MediaFile h264, hevc, aac;
+
+    /* decoded once and reused as input of the encode and filter scenarios */
+    AVFrame **video_frames;
+    int nb_video_frames;
+    AVFrame **audio_frames;
+    int nb_audio_frames;
+} BenchContext;
+
+/* what one run of a scenario processed, for the rate figures */
+typedef struct RunResult {
+    int64_t frames;
+    int64_t bytes;
+} RunResult;
+
+typedef struct Scenario {
+    const char *name;
+    int (*run)(BenchContext *ctx, RunResult *res);
+} Scenario;
+
+static int load_media(BenchContext *ctx, MediaFile *m, const char *name) {
+    uint8_t *map;
+    size_t size;
+    int ret;
+
+    m->name = name;
+    snprintf(m->path, sizeof(m->path), "%s/%s", ctx->media_dir, name);
+    ret = av_file_map(m->path, &map, &size, 0, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Could not map %s: %s\n", m->path, av_err2str(ret));
+        return ret;
+    }
+    m->data = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (m->data) {
+        memcpy(m->data, map, size);
+        m->size = size;
+    }
+    av_file_unmap(map, size);
+    return m->data ? 0 : AVERROR(ENOMEM);
+}
+
+static int receive_decoded(AVCodecContext *c, AVFrame *frame, RunResult *res,
+                           AVFrame ***frames, int *nb_frames) {
+    int ret;
+
+    while ((ret = avcodec_receive_frame(c, frame)) >= 0) {
+        res->frames++;
+        if (frames) {
+            AVFrame *clone = av_frame_clone(frame);
+            if (!clone || av_dynarray_add_nofree(frames, nb_frames, clone) < 0) {
+                av_frame_free(&clone);
+                return AVERROR(ENOMEM);
+            }
+            clone->pts = *nb_frames - 1;
+        }
+        av_frame_unref(frame);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* decode an elementary stream, optionally keeping the decoded frames; with
+ * keyframes_only the non-key pictures are skipped like decode_video -keyframes */
+static int decode_es(const MediaFile *m, enum AVCodecID codec_id, int keyframes_only,
+                     RunResult *res, AVFrame ***frames, int *nb_frames) {
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    AVCodecParserContext *parser = NULL;
+    AVCodecContext *c = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    const uint8_t *data = m->data;
+    size_t data_size = m->size;
+    int ret = AVERROR(ENOMEM);
+
+    if (!codec) {
+        ret = AVERROR_DECODER_NOT_FOUND;
+        goto end;
+    }
+    parser = av_parser_init(codec->id);
+    c = avcodec_alloc_context3(codec);
+    if (!parser || !c || !pkt || !frame)
+        goto end;
+    if (keyframes_only) {
+        c->skip_frame = AVDISCARD_NONKEY;
+        c->skip_loop_filter = AVDISCARD_ALL;
+    }
+    if ((ret = avcodec_open2(c, codec, NULL)) < 0)
+        goto end;
+
+    do {
+        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size, data, data_size,
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (ret < 0)
+            goto end;
+        data += ret;
+        data_size -= ret;
+        if (pkt->size) {
+            if ((ret = avcodec_send_packet(c, pkt)) < 0 ||
+                (ret = receive_decoded(c, frame, res, frames, nb_frames)) < 0)
+                goto end;
+        }
+    } while (data_size > 0 || pkt->size);
+
+    if ((ret = avcodec_send_packet(c, NULL)) >= 0)
+        ret = receive_decoded(c, frame, res, frames, nb_frames);
+    res->bytes = m->size;
+
+    end:
+    av_parser_close(parser);
+    avcodec_free_context(&c);
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    return ret;
+}
+
+static int bench_decode_h264(BenchContext *ctx, RunResult *res) {
+    return decode_es(&ctx->h264, AV_CODEC_ID_H264, 0, res, NULL, NULL);
+}
+
+static int bench_decode_hevc(BenchContext *ctx, RunResult *res) {
+    return decode_es(&ctx->hevc, AV_CODEC_ID_HEVC, 0, res, NULL, NULL);
+}
+
+static int bench_keyframes_h264(BenchContext *ctx, RunResult *res) {
+    return decode_es(&ctx->h264, AV_CODEC_ID_H264, 1, res, NULL, NULL);
+}
+
+static int bench_keyframes_hevc(BenchContext *ctx, RunResult *res) {
+    return decode_es(&ctx->hevc, AV_CODEC_ID_HEVC, 1, res, NULL, NULL);
+}
+
+static int bench_decode_aac(BenchContext *ctx, RunResult *res) {
+    return decode_es(&ctx->aac, AV_CODEC_ID_AAC, 0, res, NULL, NULL);
+}
+
+/* access units found by the parser, which copies every one of them */
+static int split_parser(const MediaFile *m, enum AVCodecID codec_id, RunResult *res) {
+    AVCodecParserContext *parser = NULL;
+    AVCodecContext *c = avcodec_alloc_context3(NULL);
+    const uint8_t *data;
+    uint8_t *out;
+    size_t data_size;
+    int i, out_size, ret = AVERROR(ENOMEM);
+
+    if (!c)
+        return ret;
+    for (i = 0; i < SPLIT_PASSES; i++) {
+        parser = av_parser_init(codec_id);
+        if (!parser)
+            goto end;
+        data = m->data;
+        data_size = m->size;
+        do {
+            ret = av_parser_parse2(parser, c, &out, &out_size, data, data_size,
+                                   AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            if (ret < 0)
+                goto end;
+            data += ret;
+            data_size -= ret;
+            res->frames += out_size > 0;
+        } while (data_size > 0 || out_size);
+        av_parser_close(parser);
+        parser = NULL;
+    }
+    res->bytes = (int64_t) m->size * SPLIT_PASSES;
+    ret = 0;
+
+    end:
+    av_parser_close(parser);
+    avcodec_free_context(&c);
+    return ret;
+}
+
+static void media_buffer_free(void *opaque, uint8_t *data) {
+    /* the data stays with the MediaFile */
+}
+
+/* access units found by the Annex B splitter, as packets referencing the input */
+static int split_annexb(const MediaFile *m, enum AVCodecID codec_id, RunResult *res) {
+    AnnexBSplitter splitter;
+    AVBufferRef *buf;
+    AVPacket *pkt = av_packet_alloc();
+    int i, ret = AVERROR(ENOMEM);
+
+    buf = av_buffer_create(m->data, m->size + AV_INPUT_BUFFER_PADDING_SIZE, media_buffer_free,
+                           NULL, AV_BUFFER_FLAG_READONLY);
+    if (!buf || !pkt)
+        goto end;
+    for (i = 0; i < SPLIT_PASSES; i++) {
+        if ((ret = annexb_splitter_init(&splitter, codec_id, m->data, m->size)) < 0)
+            goto end;
+        while ((ret = annexb_next_packet(&splitter, buf, pkt)) >= 0)
+            res->frames++;
+        if (ret != AVERROR_EOF)
+            goto end;
+    }
+    res->bytes = (int64_t) m->size * SPLIT_PASSES;
+    ret = 0;
+
+    end:
+    av_packet_free(&pkt);
+    av_buffer_unref(&buf);
+    return ret;
+}
+
+static int bench_split_parser_h264(BenchContext *ctx, RunResult *res) {
+    return split_parser(&ctx->h264, AV_CODEC_ID_H264, res);
+}
+
+static int bench_split_parser_hevc(BenchContext *ctx, RunResult *res) {
+    return split_parser(&ctx->hevc, AV_CODEC_ID_HEVC, res);
+}
+
+static int bench_split_annexb_h264(BenchContext *ctx, RunResult *res) {
+    return split_annexb(&ctx->h264, AV_CODEC_ID_H264, res);
+}
+
+static int bench_split_annexb_hevc(BenchContext *ctx, RunResult *res) {
+    return split_annexb(&ctx->hevc, AV_CODEC_ID_HEVC, res);
+}
+
+static int receive_encoded(AVCodecContext *c, AVPacket *pkt, RunResult *res) {
+    int ret;
+
+    while ((ret = avcodec_receive_packet(c, pkt)) >= 0) {
+        res->bytes += pkt->size;
+        av_packet_unref(pkt);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* encode the given frames and count the compressed bytes */
+static int encode_frames(const char *encoder, AVFrame **frames, int nb_frames,
+                         const AVDictionary *enc_opts, RunResult *res) {
+    const AVCodec *codec = avcodec_find_encoder_by_name(encoder);
+    AVCodecContext *c = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    AVDictionary *opts = NULL;
+    int64_t pts = 0;
+    int i, ret;
+
+    if (!codec) {
+        ret = AVERROR_ENCODER_NOT_FOUND;
+        goto end;
+    }
+    if (!nb_frames) {
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
+    c = avcodec_alloc_context3(codec);
+    if (!c || !pkt) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if (codec->type == AVMEDIA_TYPE_VIDEO) {
+        c->width = frames[0]->width;
+        c->height = frames[0]->height;
+        c->pix_fmt = frames[0]->format;
+        c->time_base = (AVRational) {1, 25};
+        c->framerate = (AVRational) {25, 1};
+        c->bit_rate = 400000;
+    } else {
+        c->sample_fmt = frames[0]->format;
+        c->sample_rate = frames[0]->sample_rate;
+        c->channel_layout = frames[0]->channel_layout;
+        c->channels = frames[0]->channels;
+        c->time_base = (AVRational) {1, c->sample_rate};
+        c->bit_rate = 64000;
+    }
+
+    av_dict_copy(&opts, enc_opts, 0);
+    ret = avcodec_open2(c, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        goto end;
+
+    for (i = 0; i < nb_frames; i++) {
+        /* the frames are shared between runs, pts is set on a new reference */
+        AVFrame *frame = av_frame_clone(frames[i]);
+        if (!frame) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        frame->pts = pts;
+        pts += codec->type == AVMEDIA_TYPE_VIDEO ? 1 : frame->nb_samples;
+        ret = avcodec_send_frame(c, frame);
+        av_frame_free(&frame);
+        if (ret < 0 || (ret = receive_encoded(c, pkt, res)) < 0)
+            goto end;
+        res->frames++;
+    }
+    if ((ret = avcodec_send_frame(c, NULL)) >= 0)
+        ret = receive_encoded(c, pkt, res);
+
+    end:
+    avcodec_free_context(&c);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static int bench_encode_h264(BenchContext *ctx, RunResult *res) {
+    AVDictionary *opts = NULL;
+    int ret;
+
+    av_dict_set(&opts, "preset", "veryfast", 0);
+    ret = encode_frames("libx264", ctx->video_frames, ctx->nb_video_frames, opts, res);
+    av_dict_free(&opts);
+    return ret;
+}
+
+static int bench_encode_h265(BenchContext *ctx, RunResult *res) {
+    AVDictionary *opts = NULL;
+    int ret;
+
+    av_dict_set(&opts, "preset", "veryfast", 0);
+    av_dict_set(&opts, "x265-params", "log-level=error", 0);
+    ret = encode_frames("libx265", ctx->video_frames, ctx->nb_video_frames, opts, res);
+    av_dict_free(&opts);
+    return ret;
+}
+
+static int bench_encode_aac(BenchContext *ctx, RunResult *res) {
+    return encode_frames("aac", ctx->audio_frames, ctx->nb_audio_frames, NULL, res);
+}
+
+static int pull_filtered(AVFilterContext *sink, AVFrame *frame, RunResult *res) {
+    int ret;
+
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+        res->frames++;
+        res->bytes += av_image_get_buffer_size(frame->format, frame->width, frame->height, 1);
+        av_frame_unref(frame);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int bench_filter(BenchContext *ctx, RunResult *res) {
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src = NULL, *sink = NULL;
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs = avfilter_inout_alloc();
+    AVFrame *frame = av_frame_alloc();
+    const AVFrame *first;
+    char args[256];
+    int i, ret = AVERROR(ENOMEM);
+
+    if (!graph || !outputs || !inputs || !frame)
+        goto end;
+    if (!ctx->nb_video_frames) {
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
+    first = ctx->video_frames[0];
+
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=1/25:pixel_aspect=1/1",
+             first->width, first->height, first->format);
+    if ((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("buffer"), "in",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out",
+                                            NULL, NULL, graph)) < 0)
+        goto end;
+
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = src;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+    if ((ret = avfilter_graph_parse_ptr(graph, FILTER_DESCR, &inputs, &outputs, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    for (i = 0; i < ctx->nb_video_frames; i++) {
+        if ((ret = av_buffersrc_add_frame_flags(src, ctx->video_frames[i],
+                                                AV_BUFFERSRC_FLAG_KEEP_REF)) < 0 ||
+            (ret = pull_filtered(sink, frame, res)) < 0)
+            goto end;
+    }
+    if ((ret = av_buffersrc_add_frame_flags(src, NULL, 0)) >= 0)
+        ret = pull_filtered(sink, frame, res);
+
+    end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    avfilter_graph_free(&graph);
+    av_frame_free(&frame);
+    return ret;
+}
+
+/* stream copy ds.264 into FLV, written to memory to leave the disk out */
+static int bench_mux(BenchContext *ctx, RunResult *res) {
+    AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
+    AVStream *in_st, *out_st;
+    AVPacket pkt;
+    uint8_t *out_buf = NULL;
+    int ret;
+
+    /* raw H.264 carries no timestamps, let libavformat generate them */
+    ifmt_ctx = avformat_alloc_context();
+    if (!ifmt_ctx)
+        return AVERROR(ENOMEM);
+    ifmt_ctx->flags |= AVFMT_FLAG_GENPTS;
+    if ((ret = avformat_open_input(&ifmt_ctx, ctx->h264.path, NULL, NULL)) < 0 ||
+        (ret = avformat_find_stream_info(ifmt_ctx, NULL)) < 0)
+        goto end;
+    if ((ret = avformat_alloc_output_context2(&ofmt_ctx, NULL, "flv", NULL)) < 0)
+        goto end;
+
+    in_st = ifmt_ctx->streams[0];
+    out_st = avformat_new_stream(ofmt_ctx, NULL);
+    if (!out_st) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avcodec_parameters_copy(out_st->codecpar, in_st->codecpar)) < 0)
+        goto end;
+    out_st->codecpar->codec_tag = 0;
+
+    if ((ret = avio_open_dyn_buf(&ofmt_ctx->pb)) < 0 ||
+        (ret = avformat_write_header(ofmt_ctx, NULL)) < 0)
+        goto end;
+
+    while ((ret = av_read_frame(ifmt_ctx, &pkt)) >= 0) {
+        av_packet_rescale_ts(&pkt, in_st->time_base, out_st->time_base);
+        pkt.stream_index = out_st->index;
+        pkt.pos = -1;
+        ret = av_interleaved_write_frame(ofmt_ctx, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            goto end;
+        res->frames++;
+    }
+    ret = av_write_trailer(ofmt_ctx);
+
+    end:
+    if (ofmt_ctx && ofmt_ctx->pb) {
+        int size = avio_close_dyn_buf(ofmt_ctx->pb, &out_buf);
+        ofmt_ctx->pb = NULL;
+        res->bytes = FFMAX(size, 0);
+        av_free(out_buf);
+    }
+    avformat_free_context(ofmt_ctx);
+    avformat_close_input(&ifmt_ctx);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static const Scenario scenarios[] = {
+        {"decode_h264",    bench_decode_h264},
+        {"decode_hevc",    bench_decode_hevc},
+        {"keyframes_h264", bench_keyframes_h264},
+        {"keyframes_hevc", bench_keyframes_hevc},
+        {"decode_aac",     bench_decode_aac},
+        {"split_parser_h264", bench_split_parser_h264},
+        {"split_parser_hevc", bench_split_parser_hevc},
+        {"split_annexb_h264", bench_split_annexb_h264},
+        {"split_annexb_hevc", bench_split_annexb_hevc},
+        {"encode_h264",    bench_encode_h264},
+        {"encode_h265",    bench_encode_h265},
+        {"encode_aac",     bench_encode_aac},
+        {"filter",         bench_filter},
+        {"mux_flv",        bench_mux},
+};
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int selected(const char *name, char **names, int nb_names) {
+    int i;
+
+    if (!nb_names)
+        return 1;
+    for (i = 0; i < nb_names; i++)
+        if (!strcmp(names[i], name))
+            return 1;
+    return 0;
+}
+
+static void run_scenario(BenchContext *ctx, const Scenario *sc, int repeat, FILE *out, int first) {
+    int64_t times[MAX_REPEAT];
+    RunResult res = {0};
+    double median, p95;
+    int i, ret = 0;
+
+    for (i = 0; i < repeat; i++) {
+        int64_t start = av_gettime_relative();
+        memset(&res, 0, sizeof(res));
+        ret = sc->run(ctx, &res);
+        times[i] = av_gettime_relative() - start;
+        if (ret < 0)
+            break;
+    }
+
+    fprintf(out, "%s    {\"name\": \"%s\", ", first ? "" : ",\n", sc->name);
+    if (ret < 0) {
+        fprintf(stderr, "%s failed: %s\n", sc->name, av_err2str(ret));
+        fprintf(out, "\"error\": \"%s\"}", av_err2str(ret));
+        return;
+    }
+
+    qsort(times, repeat, sizeof(*times), compare_int64);
+    median = (repeat % 2 ? times[repeat / 2] : (times[repeat / 2 - 1] + times[repeat / 2]) / 2.0) / 1e6;
+    p95 = times[(int) ceil(0.95 * repeat) - 1] / 1e6;
+    fprintf(out, "\"runs\": %d, \"median_s\": %.6f, \"p95_s\": %.6f, "
+                 "\"frames\": %"PRId64", \"bytes\": %"PRId64", "
+                 "\"frames_per_s\": %.2f, \"bytes_per_s\": %.0f}",
+            repeat, median, p95, res.frames, res.bytes,
+            median > 0 ? res.frames / median : 0.0,
+            median > 0 ? res.bytes / median : 0.0);
+    fflush(out);
+}
+
+static void free_frames(AVFrame ***frames, int *nb_frames) {
+    int i;
+
+    for (i = 0; i < *nb_frames; i++)
+        av_frame_free(&(*frames)[i]);
+    av_freep(frames);
+    *nb_frames = 0;
+}
+
+int main(int argc, char **argv) {
+    BenchContext ctx = {0};
+    RunResult res = {0};
+    const char *out_filename = NULL;
+    FILE *out = stdout;
+    char **names = NULL;
+    int nb_names = 0;
+    int repeat = DEFAULT_REPEAT;
+    int i, ret, first = 1;
+
+    ctx.media_dir = "..";
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-repeat") && i + 1 < argc) {
+            repeat = av_clip(atoi(argv[++i]), 1, MAX_REPEAT);
+        } else if (!strcmp(argv[i], "-media") && i + 1 < argc) {
+            ctx.media_dir = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out_filename = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-repeat N] [-media DIR] [-o FILE] [scenario...]\n"
+                            "Runs every scenario, or the named ones, N times (default %d) on\n"
+                            "the sample media in DIR (default ..) and prints the results as JSON.\n",
+                    argv[0], DEFAULT_REPEAT);
+            return 1;
+        } else {
+            names = argv + i;
+            nb_names = argc - i;
+            break;
+        }
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    if (load_media(&ctx, &ctx.h264, "ds.264") < 0 ||
+        load_media(&ctx, &ctx.hevc, "ds.hevc") < 0 ||
+        load_media(&ctx, &ctx.aac, "origin.aac") < 0)
+        return 1;
+
+    /* inputs of the encode and filter scenarios */
+    ret = decode_es(&ctx.h264, AV_CODEC_ID_H264, 0, &res, &ctx.video_frames, &ctx.nb_video_frames);
+    if (ret >= 0)
+        ret = decode_es(&ctx.aac, AV_CODEC_ID_AAC, 0, &res, &ctx.audio_frames, &ctx.nb_audio_frames);
+    if (ret < 0) {
+        fprintf(stderr, "Could not decode the sample media: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    if (out_filename) {
+        out = fopen(out_filename, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open %s\n", out_filename);
+            return 1;
+        }
+    }
+
+    /* the versions of the libraries loaded at run time, not of the headers */
+    fprintf(out, "{\n  \"ffmpeg\": \"%s\",\n  \"libavcodec\": \"%d.%d.%d\",\n"
+                 "  \"libavutil\": \"%d.%d.%d\",\n"
+                 "  \"repeat\": %d,\n  \"scenarios\": [\n",
+            av_version_info(),
+            AV_VERSION_MAJOR(avcodec_version()), AV_VERSION_MINOR(avcodec_version()),
+            AV_VERSION_MICRO(avcodec_version()),
+            AV_VERSION_MAJOR(avutil_version()), AV_VERSION_MINOR(avutil_version()),
+            AV_VERSION_MICRO(avutil_version()), repeat);
+    for (i = 0; i < FF_ARRAY_ELEMS(scenarios); i++) {
+        if (!selected(scenarios[i].name, names, nb_names))
+            continue;
+        run_scenario(&ctx, &scenarios[i], repeat, out, first);
+        first = 0;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+    free_frames(&ctx.video_frames, &ctx.nb_video_frames);
+    free_frames(&ctx.audio_frames, &ctx.nb_audio_frames);
+    av_free(ctx.h264.data);
+    av_free(ctx.hevc.data);
+    av_free(ctx.aac.data);
+
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include "annexb.h"
+
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+/* H.264 NAL unit types, SEI up to AUD open an access unit */
+#define H264_NAL_IDR_SLICE 5
+#define H264_NAL_SEI       6
+#define H264_NAL_SPS       7
+#define H264_NAL_PPS       8
+#define H264_NAL_AUD       9
+
+/* HEVC NAL unit types, VPS up to AUD and the prefix SEI open an access unit */
+#define HEVC_NAL_BLA_W_LP   16
+#define HEVC_NAL_VPS        32
+#define HEVC_NAL_SPS        33
+#define HEVC_NAL_PPS        34
+#define HEVC_NAL_AUD        35
+#define HEVC_NAL_SEI_PREFIX 39
+
+static const uint8_t *find_start_code_c(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *one;
+
+    while (end - p >= 3) {
+        one = memchr(p + 2, 1, end - p - 2);
+        if (!one)
+            break;
+        if (!one[-1] && !one[-2])
+            return one - 2;
+        p = one - 1;
+    }
+    return end;
+}
+
+#if HAVE_X86_SIMD
+/* a start code begins at every position i with p[i] == 0, p[i + 1] == 0 and
+ * p[i + 2] == 1: three overlapping loads test a whole register of positions */
+__attribute__((target("sse2")))
+static const uint8_t *find_start_code_sse2(const uint8_t *p, const uint8_t *end) {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    __m128i a, b, c;
+    unsigned mask;
+
+    while (end - p >= 16 + 2) {
+        a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), zero);
+        b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 1)), zero);
+        c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 2)), one);
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return find_start_code_c(p, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *find_start_code_avx2(const uint8_t *p, const uint8_t *end) {
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+    __m256i a, b, c;
+    unsigned mask;
+
+    while (end - p >= 32 + 2) {
+        a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), zero);
+        b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 1)), zero);
+        c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 2)), one);
+        mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_start_code_sse2(p, end);
+}
+#endif
+
+const uint8_t *annexb_find_start_code(const uint8_t *p, const uint8_t *end) {
+#if HAVE_X86_SIMD
+    /* av_get_cpu_flags() caches the detection, and honours av_force_cpu_flags() */
+    int flags = av_get_cpu_flags();
+
+    if (flags & AV_CPU_FLAG_AVX2)
+        return find_start_code_avx2(p, end);
+    if (flags & AV_CPU_FLAG_SSE2)
+        return find_start_code_sse2(p, end);
+#endif
+    return find_start_code_c(p, end);
+}
+
+int annexb_read_bit(AnnexBBitReader *br) {
+    int b;
+
+    if (!br->bit) {
+        if (br->pos >= br->size)
+            return 0;
+        if (br->zeros >= 2 && br->data[br->pos] == 3) {
+            br->zeros = 0;
+            if (++br->pos >= br->size)
+                return 0;
+        }
+        br->zeros = br->data[br->pos] ? 0 : br->zeros + 1;
+    }
+    b = br->data[br->pos] >> (7 - br->bit) & 1;
+    if (++br->bit == 8) {
+        br->bit = 0;
+        br->pos++;
+    }
+    return b;
+}
+
+unsigned annexb_read_bits(AnnexBBitReader *br, int n) {
+    unsigned v = 0;
+
+    while (n--)
+        v = v << 1 | annexb_read_bit(br);
+    return v;
+}
+
+unsigned annexb_read_ue(AnnexBBitReader *br) {
+    int zeros = 0;
+
+    while (!annexb_read_bit(br) && zeros < 31)
+        zeros++;
+    return (1u << zeros) - 1 + annexb_read_bits(br, zeros);
+}
+
+/* nal_ref_idc has to be set on slices of reference pictures and parameter
+ * sets, and clear on SEI, AUD and the end and filler NAL units */
+static int valid_h264_header(const uint8_t *nal) {
+    int type = nal[0] & 0x1f, ref = nal[0] >> 5 & 3;
+
+    if (type == H264_NAL_IDR_SLICE || type == H264_NAL_SPS || type == H264_NAL_PPS)
+        return ref != 0;
+    if (type == H264_NAL_SEI || (type >= H264_NAL_AUD && type <= 12))
+        return ref == 0;
+    return type >= 1 && type <= 23;
+}
+
+/* nuh_temporal_id_plus1 is never 0 and is 1 for parameter sets, the reserved
+ * and unspecified types do not occur in real streams */
+static int valid_hevc_header(const uint8_t *nal) {
+    int type = nal[0] >> 1 & 0x3f, tid = nal[1] & 7;
+
+    if (!tid || (type >= HEVC_NAL_VPS && type <= HEVC_NAL_PPS && tid != 1))
+        return 0;
+    return type <= 9 || (type >= HEVC_NAL_BLA_W_LP && type <= 21) ||
+           (type >= HEVC_NAL_VPS && type <= 40);
+}
+
+enum AVCodecID annexb_probe(const uint8_t *data, size_t size) {
+    const uint8_t *end = data + FFMIN(size, ANNEXB_PROBE_SIZE), *p, *nal;
+    int h264 = 1, hevc = 1, h264_seen = 0, hevc_seen = 0, type;
+
+    for (p = annexb_find_start_code(data, end); p < end; p = annexb_find_start_code(nal, end)) {
+        nal = p + 3;
+        if (end - nal < 2)
+            break;
+        if (nal[0] & 0x80)      /* forbidden_zero_bit */
+            return AV_CODEC_ID_NONE;
+
+        if (h264 && (h264 = valid_h264_header(nal))) {
+            type = nal[0] & 0x1f;
+            h264_seen |= type == H264_NAL_SPS ? 1 : type == H264_NAL_PPS ? 2 : type <= 5 ? 4 : 0;
+        }
+        if (hevc && (hevc = valid_hevc_header(nal))) {
+            type = nal[0] >> 1 & 0x3f;
+            hevc_seen |= type == HEVC_NAL_VPS ? 1 : type == HEVC_NAL_SPS ? 2 :
+                         type == HEVC_NAL_PPS ? 4 : type < HEVC_NAL_VPS ? 8 : 0;
+        }
+        if (!h264 && !hevc)
+            return AV_CODEC_ID_NONE;
+    }
+
+    if (h264 && h264_seen == 7)
+        return AV_CODEC_ID_H264;
+    if (hevc && hevc_seen == 15)
+        return AV_CODEC_ID_HEVC;
+    return AV_CODEC_ID_NONE;
+}
+
+int annexb_hevc_parallel_tools(const uint8_t *data, size_t size) {
+    const uint8_t *end = data + size, *p, *nal, *next;
+    AnnexBBitReader br = {0};
+    int tools;
+
+    for (p = annexb_find_start_code(data, end); p < end; p = next) {
+        nal = p + 3;
+        next = annexb_find_start_code(nal, end);
+        if (next - nal < 3 || (nal[0] >> 1 & 0x3f) != HEVC_NAL_PPS)
+            continue;
+
+        br.data = nal + 2;
+        br.size = next - nal - 2;
+        annexb_read_ue(&br);                /* pps_pic_parameter_set_id */
+        annexb_read_ue(&br);                /* pps_seq_parameter_set_id */
+        annexb_read_bits(&br, 7);           /* dependent slices, output flag, extra
+                                             * slice header bits, sign data hiding,
+                                             * cabac_init_present_flag */
+        annexb_read_ue(&br);                /* num_ref_idx_l0_default_active_minus1 */
+        annexb_read_ue(&br);                /* num_ref_idx_l1_default_active_minus1 */
+        annexb_read_ue(&br);                /* init_qp_minus26 */
+        annexb_read_bits(&br, 2);           /* constrained_intra_pred_flag, transform_skip_enabled_flag */
+        if (annexb_read_bit(&br))           /* cu_qp_delta_enabled_flag */
+            annexb_read_ue(&br);            /* diff_cu_qp_delta_depth */
+        annexb_read_ue(&br);                /* pps_cb_qp_offset */
+        annexb_read_ue(&br);                /* pps_cr_qp_offset */
+        annexb_read_bits(&br, 4);           /* slice chroma qp offsets, weighted
+                                             * prediction and bi-prediction,
+                                             * transquant bypass */
+        tools = annexb_read_bit(&br) ? ANNEXB_HEVC_TILES : 0;
+        if (annexb_read_bit(&br))
+            tools |= ANNEXB_HEVC_WPP;
+        return tools;
+    }
+    return 0;
+}
+
+int annexb_splitter_init(AnnexBSplitter *s, enum AVCodecID codec_id, const uint8_t *data, size_t size) {
+    if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+        return AVERROR(EINVAL);
+    s->codec_id = codec_id;
+    s->data = data;
+    s->size = size;
+    s->next = annexb_find_start_code(data, data + size) - data;
+    return 0;
+}
+
+/* the same access unit boundaries as the keyframe index: a slice with its
+ * first slice flag set, or an AUD, SEI or parameter set, after the slices of
+ * the current access unit */
+int annexb_next_access_unit(AnnexBSplitter *s, size_t *offset, size_t *size) {
+    const uint8_t *data = s->data, *end = data + s->size;
+    int h264 = s->codec_id == AV_CODEC_ID_H264;
+    size_t sc, next_sc, start, nal, au_start = s->size;
+    int type, vcl, seen_vcl = 0;
+
+    for (sc = s->next; sc < s->size; sc = next_sc) {
+        nal = sc + 3;
+        next_sc = annexb_find_start_code(data + nal, end) - data;
+        /* the zero byte of a 4 byte start code belongs to the NAL unit after it */
+        start = sc && !data[sc - 1] ? sc - 1 : sc;
+
+        if (nal + (h264 ? 2 : 3) <= next_sc) {
+            if (h264) {
+                type = data[nal] & 0x1f;
+                vcl = type >= 1 && type <= 5;
+            } else {
+                type = data[nal] >> 1 & 0x3f;
+                vcl = type < 32;
+            }
+            if (seen_vcl && (vcl ? data[nal + (h264 ? 1 : 2)] & 0x80
+                                 : h264 ? type >= H264_NAL_SEI && type <= H264_NAL_AUD
+                                        : (type >= HEVC_NAL_VPS && type <= HEVC_NAL_AUD) ||
+                                          type == HEVC_NAL_SEI_PREFIX)) {
+                s->next = sc;
+                *offset = au_start;
+                *size = start - au_start;
+                return 0;
+            }
+            seen_vcl |= vcl;
+        }
+        if (au_start == s->size)
+            au_start = start;
+    }
+
+    s->next = s->size;
+    if (au_start == s->size)
+        return AVERROR_EOF;
+    *offset = au_start;
+    *size = s->size - au_start;
+    return 0;
+}
+
+int annexb_next_packet(AnnexBSplitter *s, AVBufferRef *buf, AVPacket *pkt) {
+    const uint8_t *data;
+    size_t offset, size;
+    int ret;
+
+    av_packet_unref(pkt);
+    if ((ret = annexb_next_access_unit(s, &offset, &size)) < 0)
+        return ret;
+    if (size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR_INVALIDDATA;
+    data = s->data + offset;
+
+    /* the bytes after the access unit are the next one, which satisfies the
+     * overread padding; the H.264/HEVC decoders unescape every NAL unit into
+     * a buffer of their own, so the padding does not have to be zero */
+    if (data >= buf->data && data + size + AV_INPUT_BUFFER_PADDING_SIZE <= buf->data + buf->size) {
+        pkt->buf = av_buffer_ref(buf);
+        if (!pkt->buf)
+            return AVERROR(ENOMEM);
+        pkt->data = (uint8_t *) data;
+        pkt->size = size;
+        return 0;
+    }
+
+    if ((ret = av_new_packet(pkt, size)) < 0)
+        return ret;
+    memcpy(pkt->data, data, size);
+    return 0;
+}
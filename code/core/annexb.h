@@ -0,0 +1,99 @@
+/**
+ * @file
+ * Annex B start code scanning and access unit splitting for H.264/HEVC.
+ *
+ * The start code finder compares 16 (SSE2) or 32 (AVX2) positions at once
+ * and is picked at run time from av_get_cpu_flags(), so av_force_cpu_flags()
+ * also selects it; other CPUs use a memchr() based scan. The splitter cuts a
+ * whole elementary stream held in memory into access units without copying
+ * it, which replaces av_parser_parse2() when the input is a mapped file.
+ * The probe tells H.264 from HEVC by the NAL unit headers at the start of a
+ * stream.
+ */
+
+#ifndef LEARNFFMPEG_ANNEXB_H
+#define LEARNFFMPEG_ANNEXB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+/**
+ * @return the first byte of the first 00 00 01 in [p, end), end if there is
+ *         none
+ */
+const uint8_t *annexb_find_start_code(const uint8_t *p, const uint8_t *end);
+
+/* bytes at the start of a stream annexb_probe() looks at */
+#define ANNEXB_PROBE_SIZE (1 << 16)
+
+/* HEVC tools that let a picture be decoded by several threads */
+#define ANNEXB_HEVC_WPP   1     ///< entropy_coding_sync_enabled_flag
+#define ANNEXB_HEVC_TILES 2     ///< tiles_enabled_flag
+
+/* reads the first bits of a NAL unit payload, skipping the emulation
+ * prevention bytes; reading past the end gives zeros */
+typedef struct AnnexBBitReader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    int bit;
+    int zeros;
+} AnnexBBitReader;
+
+int annexb_read_bit(AnnexBBitReader *br);
+
+unsigned annexb_read_bits(AnnexBBitReader *br, int n);
+
+/** Exp-Golomb ue(v), se(v) values are read as their code number */
+unsigned annexb_read_ue(AnnexBBitReader *br);
+
+/**
+ * Detect the codec of an Annex B stream from its first bytes.
+ *
+ * @return AV_CODEC_ID_H264 or AV_CODEC_ID_HEVC when every NAL unit header in
+ *         data is valid for it and the parameter sets and a slice were seen,
+ *         AV_CODEC_ID_NONE otherwise
+ */
+enum AVCodecID annexb_probe(const uint8_t *data, size_t size);
+
+/**
+ * @return the ANNEXB_HEVC_* flags of the first PPS in an HEVC stream, 0
+ *         without one
+ */
+int annexb_hevc_parallel_tools(const uint8_t *data, size_t size);
+
+typedef struct AnnexBSplitter {
+    enum AVCodecID codec_id;
+    const uint8_t *data;
+    size_t size;
+    size_t next;        ///< offset of the next start code, size at the end
+} AnnexBSplitter;
+
+/**
+ * @param codec_id AV_CODEC_ID_H264 or AV_CODEC_ID_HEVC
+ * @return 0 on success, AVERROR(EINVAL) for another codec
+ */
+int annexb_splitter_init(AnnexBSplitter *s, enum AVCodecID codec_id, const uint8_t *data, size_t size);
+
+/**
+ * Find the next access unit: its NAL units, with the start codes and the AUD,
+ * SEI and parameter sets in front of the first slice.
+ *
+ * @return 0 on success, AVERROR_EOF at the end of the data
+ */
+int annexb_next_access_unit(AnnexBSplitter *s, size_t *offset, size_t *size);
+
+/**
+ * Return the next access unit as a packet referencing buf, which must hold
+ * the data the splitter was initialized with. An access unit that ends less
+ * than AV_INPUT_BUFFER_PADDING_SIZE bytes before the end of buf is copied
+ * into a padded packet instead.
+ *
+ * @return 0 on success, AVERROR_EOF at the end of the data, or another
+ *         negative AVERROR
+ */
+int annexb_next_packet(AnnexBSplitter *s, AVBufferRef *buf, AVPacket *pkt);
+
+#endif /* LEARNFFMPEG_ANNEXB_H */
@@ -0,0 +1,270 @@
+#include "avio_async_writer.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+/* size of the AVIOContext buffer in front of the large buffers */
+#define AVIO_BUFFER_SIZE 32768
+
+typedef struct WriteBuffer {
+    int size;
+    uint8_t *data;
+} WriteBuffer;
+
+/* ring[head] .. ring[head + count - 1] are full and wait for the helper
+ * thread, the muxer fills ring[head + count], which only exists while count
+ * is below nb_buffers */
+typedef struct AsyncWriter {
+    AVIOContext *target;
+    int own_target;
+    int buffer_size;
+    int nb_buffers;
+    WriteBuffer *ring;
+    int head;
+    int count;
+    int64_t pos;        ///< position of the next byte written by the muxer
+    int err;
+    int abort;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AVIOAsyncWriterStats stats;
+} AsyncWriter;
+
+static void *writer_thread(void *arg) {
+    AsyncWriter *w = arg;
+    WriteBuffer *buf;
+    int err, ret;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->abort && !w->count)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->count)
+            break;
+        buf = &w->ring[w->head];
+        err = w->err;
+        pthread_mutex_unlock(&w->lock);
+
+        /* after an error the buffers are only recycled */
+        ret = 0;
+        if (!err) {
+            avio_write(w->target, buf->data, buf->size);
+            avio_flush(w->target);
+            ret = w->target->error;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (ret < 0) {
+            w->err = ret;
+        } else if (!w->err) {
+            w->stats.buffers++;
+            w->stats.bytes += buf->size;
+        }
+        buf->size = 0;
+        w->head = (w->head + 1) % w->nb_buffers;
+        w->count--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* called with the lock held: pass the buffer being filled to the helper
+ * thread if it holds data, then wait for a free one if wait is set */
+static void hand_off(AsyncWriter *w, int wait) {
+    int64_t wait_start;
+
+    if (w->ring[(w->head + w->count) % w->nb_buffers].size) {
+        w->count++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    if (!wait || w->count < w->nb_buffers)
+        return;
+
+    wait_start = av_gettime_relative();
+    w->stats.stalls++;
+    while (w->count == w->nb_buffers)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->stats.stall_time += av_gettime_relative() - wait_start;
+}
+
+/* called with the lock held: wait until everything written is out */
+static int drain(AsyncWriter *w) {
+    hand_off(w, 0);
+    if (w->count)
+        w->stats.drains++;
+    while (w->count)
+        pthread_cond_wait(&w->cond, &w->lock);
+    return w->err;
+}
+
+static int async_write(void *opaque, uint8_t *data, int size) {
+    AsyncWriter *w = opaque;
+    WriteBuffer *buf;
+    int n, ret = size;
+
+    pthread_mutex_lock(&w->lock);
+    while (size > 0) {
+        if (w->err) {
+            ret = w->err;
+            break;
+        }
+        buf = &w->ring[(w->head + w->count) % w->nb_buffers];
+        n = FFMIN(size, w->buffer_size - buf->size);
+        memcpy(buf->data + buf->size, data, n);
+        buf->size += n;
+        data += n;
+        size -= n;
+        w->pos += n;
+        if (buf->size == w->buffer_size)
+            hand_off(w, 1);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ret;
+}
+
+/* the target is only touched here once the helper thread is idle */
+static int64_t async_seek(void *opaque, int64_t offset, int whence) {
+    AsyncWriter *w = opaque;
+    int64_t ret;
+
+    pthread_mutex_lock(&w->lock);
+    if ((whence & ~AVSEEK_FORCE) == SEEK_SET && offset == w->pos) {
+        pthread_mutex_unlock(&w->lock);
+        return offset;
+    }
+    ret = drain(w);
+    if (ret >= 0) {
+        if (whence == AVSEEK_SIZE) {
+            ret = avio_size(w->target);
+        } else {
+            ret = avio_seek(w->target, offset, whence & ~AVSEEK_FORCE);
+            if (ret >= 0)
+                w->pos = ret;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ret;
+}
+
+static void writer_free(AsyncWriter *w) {
+    int i;
+
+    if (w->ring)
+        for (i = 0; i < w->nb_buffers; i++)
+            av_free(w->ring[i].data);
+    av_free(w->ring);
+    if (w->own_target)
+        avio_closep(&w->target);
+    av_free(w);
+}
+
+int avio_async_writer_wrap(AVIOContext **pb, AVIOContext *target, int buffer_size, int nb_buffers) {
+    AsyncWriter *w;
+    uint8_t *buffer = NULL;
+    int i, ret = AVERROR(ENOMEM);
+
+    *pb = NULL;
+    if (buffer_size <= 0 || nb_buffers < 2)
+        return AVERROR(EINVAL);
+    w = av_mallocz(sizeof(*w));
+    if (!w)
+        return AVERROR(ENOMEM);
+    w->target = target;
+    w->buffer_size = buffer_size;
+    w->nb_buffers = nb_buffers;
+    w->pos = avio_tell(target);
+
+    w->ring = av_mallocz_array(nb_buffers, sizeof(*w->ring));
+    if (!w->ring)
+        goto fail;
+    for (i = 0; i < nb_buffers; i++)
+        if (!(w->ring[i].data = av_malloc(buffer_size)))
+            goto fail;
+    buffer = av_malloc(AVIO_BUFFER_SIZE);
+    if (!buffer)
+        goto fail;
+    *pb = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 1, w, NULL, async_write, async_seek);
+    if (!*pb)
+        goto fail;
+    (*pb)->seekable = target->seekable;
+
+    if (pthread_mutex_init(&w->lock, NULL))
+        goto fail;
+    if (pthread_cond_init(&w->cond, NULL)) {
+        pthread_mutex_destroy(&w->lock);
+        goto fail;
+    }
+    if ((ret = pthread_create(&w->thread, NULL, writer_thread, w))) {
+        ret = AVERROR(ret);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    avio_context_free(pb);
+    av_free(buffer);
+    w->own_target = 0;
+    writer_free(w);
+    return ret;
+}
+
+int avio_async_writer_open(AVIOContext **pb, const char *url, int buffer_size, int nb_buffers) {
+    AVIOContext *target = NULL;
+    int ret;
+
+    if ((ret = avio_open(&target, url, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    if ((ret = avio_async_writer_wrap(pb, target, buffer_size, nb_buffers)) < 0) {
+        avio_closep(&target);
+        return ret;
+    }
+    ((AsyncWriter *) (*pb)->opaque)->own_target = 1;
+    return 0;
+}
+
+int avio_async_writer_close(AVIOContext **pb) {
+    AsyncWriter *w;
+    int ret;
+
+    if (!*pb)
+        return 0;
+    w = (*pb)->opaque;
+    avio_flush(*pb);
+
+    /* the helper thread writes what is queued before it stops */
+    pthread_mutex_lock(&w->lock);
+    hand_off(w, 0);
+    w->abort = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+
+    ret = w->err < 0 ? w->err : (*pb)->error;
+    if (w->own_target && ret >= 0)
+        ret = avio_closep(&w->target);
+    writer_free(w);
+
+    /* the internal buffer could have been reallocated by avio */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+    return ret;
+}
+
+void avio_async_writer_get_stats(AVIOContext *pb, AVIOAsyncWriterStats *stats) {
+    AsyncWriter *w = pb->opaque;
+
+    pthread_mutex_lock(&w->lock);
+    *stats = w->stats;
+    pthread_mutex_unlock(&w->lock);
+}
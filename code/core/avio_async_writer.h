@@ -0,0 +1,54 @@
+/**
+ * @file
+ * AVIOContext that writes its output on a helper thread.
+ *
+ * The muxer writes into one of a fixed number of large buffers; a full buffer
+ * is handed to the helper thread, which writes it to the real output while
+ * the next one is filled. Memory is bounded by the number of buffers: when
+ * all of them wait for the helper thread, the writer blocks until one is
+ * free again. A seek, which muxers use to patch headers, first waits until
+ * everything written before it is out.
+ */
+
+#ifndef LEARNFFMPEG_AVIO_ASYNC_WRITER_H
+#define LEARNFFMPEG_AVIO_ASYNC_WRITER_H
+
+#include <stdint.h>
+
+#include <libavformat/avio.h>
+
+typedef struct AVIOAsyncWriterStats {
+    int64_t buffers;        ///< buffers written by the helper thread
+    int64_t bytes;          ///< bytes written by the helper thread
+    int64_t stalls;         ///< writes that had to wait for a free buffer
+    int64_t stall_time;     ///< time spent waiting, in microseconds
+    int64_t drains;         ///< seeks that waited for the output to be written
+} AVIOAsyncWriterStats;
+
+/**
+ * Write to target on a helper thread. target must stay open until
+ * avio_async_writer_close(), from then on it is only used through pb.
+ *
+ * @param buffer_size size of one buffer handed to the helper thread
+ * @param nb_buffers  number of buffers, at least 2
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int avio_async_writer_wrap(AVIOContext **pb, AVIOContext *target, int buffer_size, int nb_buffers);
+
+/**
+ * Open url with avio_open() for writing and write to it on a helper thread,
+ * the output is closed with the returned context.
+ */
+int avio_async_writer_open(AVIOContext **pb, const char *url, int buffer_size, int nb_buffers);
+
+/**
+ * Write out what is still buffered, stop the helper thread and free the
+ * context (and close the output it opened).
+ *
+ * @return 0, or the first error the output failed with
+ */
+int avio_async_writer_close(AVIOContext **pb);
+
+void avio_async_writer_get_stats(AVIOContext *pb, AVIOAsyncWriterStats *stats);
+
+#endif /* LEARNFFMPEG_AVIO_ASYNC_WRITER_H */
@@ -0,0 +1,374 @@
+#include "avio_cache.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+typedef struct CacheBlock {
+    int file_id;
+    int64_t index;
+    int size;                       ///< less than block_size at the end of a file
+    struct CacheBlock *hash_next;
+    struct CacheBlock *lru_prev;    ///< towards the most recently used block
+    struct CacheBlock *lru_next;
+    uint8_t data[];
+} CacheBlock;
+
+/* the inputs are assumed not to change while their blocks are cached, the
+ * size seen by the first open is reused by the later ones */
+typedef struct CachedFile {
+    char *url;
+    int64_t size;
+} CachedFile;
+
+struct AVIOCache {
+    pthread_mutex_t lock;
+    int block_size;
+    int64_t max_size;
+    CacheBlock **buckets;
+    unsigned nb_buckets;            ///< power of two
+    CacheBlock *lru_head;           ///< most recently used
+    CacheBlock *lru_tail;           ///< next to be evicted
+    CachedFile *files;              ///< file ids are indexes in this table
+    int nb_files;
+    AVIOCacheStats stats;
+};
+
+/* opaque of one AVIOContext */
+typedef struct CachedInput {
+    AVIOCache *cache;
+    char *url;
+    AVIOContext *source;            ///< opened on the first miss only
+    int file_id;
+    int64_t pos;
+    int64_t size;
+} CachedInput;
+
+static unsigned block_hash(const AVIOCache *c, int file_id, int64_t index) {
+    uint64_t h = ((uint64_t) file_id << 40 ^ (uint64_t) index) * UINT64_C(0x9E3779B97F4A7C15);
+
+    return (unsigned) (h >> 32) & (c->nb_buckets - 1);
+}
+
+static void lru_unlink(AVIOCache *c, CacheBlock *b) {
+    if (b->lru_prev)
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        c->lru_head = b->lru_next;
+    if (b->lru_next)
+        b->lru_next->lru_prev = b->lru_prev;
+    else
+        c->lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(AVIOCache *c, CacheBlock *b) {
+    b->lru_next = c->lru_head;
+    if (c->lru_head)
+        c->lru_head->lru_prev = b;
+    c->lru_head = b;
+    if (!c->lru_tail)
+        c->lru_tail = b;
+}
+
+/* called with the lock held, a hit becomes the most recently used block */
+static CacheBlock *find_block(AVIOCache *c, int file_id, int64_t index) {
+    CacheBlock *b;
+
+    for (b = c->buckets[block_hash(c, file_id, index)]; b; b = b->hash_next) {
+        if (b->file_id == file_id && b->index == index) {
+            lru_unlink(c, b);
+            lru_push_front(c, b);
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* called with the lock held; if another reader loaded the same block in the
+ * meantime, that one is kept and the new copy freed */
+static CacheBlock *insert_block(AVIOCache *c, CacheBlock *block) {
+    CacheBlock *b = find_block(c, block->file_id, block->index);
+    unsigned h;
+
+    if (b) {
+        av_free(block);
+        return b;
+    }
+    h = block_hash(c, block->file_id, block->index);
+    block->hash_next = c->buckets[h];
+    c->buckets[h] = block;
+    lru_push_front(c, block);
+    c->stats.size += block->size;
+    c->stats.nb_blocks++;
+    c->stats.bytes_loaded += block->size;
+    return block;
+}
+
+/* called with the lock held, the most recently used block is always kept */
+static void evict_blocks(AVIOCache *c) {
+    while (c->stats.size > c->max_size && c->lru_tail && c->lru_tail != c->lru_head) {
+        CacheBlock *victim = c->lru_tail;
+        CacheBlock **p = &c->buckets[block_hash(c, victim->file_id, victim->index)];
+
+        while (*p != victim)
+            p = &(*p)->hash_next;
+        *p = victim->hash_next;
+        lru_unlink(c, victim);
+        c->stats.size -= victim->size;
+        c->stats.nb_blocks--;
+        c->stats.evictions++;
+        av_free(victim);
+    }
+}
+
+static int load_block(CachedInput *in, int64_t index, CacheBlock **pblock) {
+    int block_size = in->cache->block_size;
+    CacheBlock *block;
+    int64_t pos;
+    int ret;
+
+    if (!in->source && (ret = avio_open(&in->source, in->url, AVIO_FLAG_READ)) < 0)
+        return ret;
+    block = av_malloc(sizeof(*block) + block_size);
+    if (!block)
+        return AVERROR(ENOMEM);
+
+    pos = avio_seek(in->source, index * block_size, SEEK_SET);
+    ret = pos < 0 ? (int) pos : avio_read(in->source, block->data, block_size);
+    if (ret < 0) {
+        av_free(block);
+        return ret;
+    }
+    block->file_id = in->file_id;
+    block->index = index;
+    block->size = ret;
+    block->hash_next = block->lru_prev = block->lru_next = NULL;
+    *pblock = block;
+    return 0;
+}
+
+static int cached_read(void *opaque, uint8_t *buf, int buf_size) {
+    CachedInput *in = opaque;
+    AVIOCache *c = in->cache;
+    int64_t index = in->pos / c->block_size;
+    int offset = in->pos % c->block_size;
+    CacheBlock *block, *loaded = NULL;
+    int hit, ret;
+
+    pthread_mutex_lock(&c->lock);
+    block = find_block(c, in->file_id, index);
+    hit = block != NULL;
+    if (hit) {
+        c->stats.hits++;
+    } else {
+        /* storage is read without the lock, other readers keep going */
+        pthread_mutex_unlock(&c->lock);
+        ret = load_block(in, index, &loaded);
+        if (ret < 0)
+            return ret;
+        pthread_mutex_lock(&c->lock);
+        c->stats.misses++;
+        block = insert_block(c, loaded);
+    }
+
+    ret = FFMIN(buf_size, block->size - offset);
+    if (ret > 0) {
+        memcpy(buf, block->data + offset, ret);
+        in->pos += ret;
+        if (hit)
+            c->stats.bytes_cached += ret;
+    }
+    evict_blocks(c);
+    pthread_mutex_unlock(&c->lock);
+
+    return ret > 0 ? ret : AVERROR_EOF;
+}
+
+static int64_t cached_seek(void *opaque, int64_t offset, int whence) {
+    CachedInput *in = opaque;
+    int64_t pos;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return in->size >= 0 ? in->size : AVERROR(ENOSYS);
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = in->pos + offset;
+            break;
+        case SEEK_END:
+            if (in->size < 0)
+                return AVERROR(ENOSYS);
+            pos = in->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    in->pos = pos;
+    return pos;
+}
+
+/* called with the lock held */
+static int find_file(AVIOCache *c, const char *url) {
+    CachedFile *files;
+    int i;
+
+    for (i = 0; i < c->nb_files; i++)
+        if (!strcmp(c->files[i].url, url))
+            return i;
+
+    files = av_realloc_array(c->files, c->nb_files + 1, sizeof(*files));
+    if (!files)
+        return AVERROR(ENOMEM);
+    c->files = files;
+    files[i].url = av_strdup(url);
+    files[i].size = AVERROR(EAGAIN);
+    if (!files[i].url)
+        return AVERROR(ENOMEM);
+    c->nb_files++;
+    return i;
+}
+
+AVIOCache *avio_cache_alloc(int64_t max_size, int block_size) {
+    AVIOCache *c;
+    int64_t max_blocks;
+
+    if (max_size <= 0 || block_size <= 0)
+        return NULL;
+    c = av_mallocz(sizeof(*c));
+    if (!c)
+        return NULL;
+    c->max_size = max_size;
+    c->block_size = block_size;
+
+    /* keep the chains around half a block long when the cache is full */
+    max_blocks = max_size / block_size + 1;
+    for (c->nb_buckets = 16; c->nb_buckets < 2 * max_blocks && c->nb_buckets < (1u << 24); )
+        c->nb_buckets *= 2;
+    c->buckets = av_mallocz_array(c->nb_buckets, sizeof(*c->buckets));
+    if (!c->buckets || pthread_mutex_init(&c->lock, NULL)) {
+        av_freep(&c->buckets);
+        av_freep(&c);
+        return NULL;
+    }
+    return c;
+}
+
+void avio_cache_free(AVIOCache **pcache) {
+    AVIOCache *c = *pcache;
+    CacheBlock *b, *next;
+    int i;
+
+    if (!c)
+        return;
+    for (b = c->lru_head; b; b = next) {
+        next = b->lru_next;
+        av_free(b);
+    }
+    for (i = 0; i < c->nb_files; i++)
+        av_free(c->files[i].url);
+    av_free(c->files);
+    av_free(c->buckets);
+    pthread_mutex_destroy(&c->lock);
+    av_freep(pcache);
+}
+
+int avio_cache_open(AVIOContext **pb, AVIOCache *cache, const char *url, int buffer_size) {
+    CachedInput *in;
+    uint8_t *buffer = NULL;
+    int64_t size;
+    int ret;
+
+    *pb = NULL;
+    in = av_mallocz(sizeof(*in));
+    if (!in)
+        return AVERROR(ENOMEM);
+    in->cache = cache;
+    in->url = av_strdup(url);
+    if (!in->url) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    ret = in->file_id = find_file(cache, url);
+    size = ret >= 0 ? cache->files[ret].size : 0;
+    pthread_mutex_unlock(&cache->lock);
+    if (ret < 0)
+        goto fail;
+
+    /* only the first open of a file touches the input, the later ones are
+     * served from the cache until a block is missing */
+    if (size == AVERROR(EAGAIN)) {
+        if ((ret = avio_open(&in->source, url, AVIO_FLAG_READ)) < 0)
+            goto fail;
+        size = avio_size(in->source);
+        pthread_mutex_lock(&cache->lock);
+        cache->files[in->file_id].size = size;
+        pthread_mutex_unlock(&cache->lock);
+    }
+    in->size = size;
+
+    if (buffer_size <= 0)
+        buffer_size = cache->block_size;
+    buffer = av_malloc(buffer_size);
+    if (!buffer) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    *pb = avio_alloc_context(buffer, buffer_size, 0, in, cached_read, NULL, cached_seek);
+    if (!*pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    av_free(buffer);
+    avio_closep(&in->source);
+    av_free(in->url);
+    av_free(in);
+    return ret;
+}
+
+void avio_cache_close(AVIOContext **pb) {
+    CachedInput *in;
+
+    if (!*pb)
+        return;
+    in = (*pb)->opaque;
+    avio_closep(&in->source);
+    av_free(in->url);
+    av_free(in);
+    /* the internal buffer could have been reallocated by avio */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+void avio_cache_get_stats(AVIOCache *cache, AVIOCacheStats *stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void avio_cache_dump(AVIOCache *cache, FILE *out) {
+    AVIOCacheStats s;
+    int64_t reads;
+
+    avio_cache_get_stats(cache, &s);
+    reads = s.hits + s.misses;
+    fprintf(out, "avio cache: %d blocks of %d bytes, %"PRId64" of %"PRId64" bytes used\n",
+            s.nb_blocks, cache->block_size, s.size, cache->max_size);
+    fprintf(out, "  reads %"PRId64", hits %"PRId64", misses %"PRId64", hit rate %.1f%%, evictions %"PRId64"\n",
+            reads, s.hits, s.misses, reads ? 100.0 * s.hits / reads : 0.0, s.evictions);
+    fprintf(out, "  bytes from cache %"PRId64", bytes loaded %"PRId64"\n",
+            s.bytes_cached, s.bytes_loaded);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file
+ * AVIOContext with a shared, size-bounded LRU block cache.
+ *
+ * Inputs are read in fixed-size blocks keyed by (url, block index). The
+ * blocks live in one AVIOCache that any number of AVIOContexts, on any
+ * thread, can share, so probing, thumbnailing and transcoding the same file
+ * one after the other only go to the storage once, and seeks back into data
+ * already read are served from memory. When the cache is over its size the
+ * least recently used blocks are dropped.
+ */
+
+#ifndef LEARNFFMPEG_AVIO_CACHE_H
+#define LEARNFFMPEG_AVIO_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavformat/avio.h>
+
+typedef struct AVIOCache AVIOCache;
+
+typedef struct AVIOCacheStats {
+    int64_t hits;           ///< reads served from a cached block
+    int64_t misses;         ///< reads that had to load a block
+    int64_t evictions;      ///< blocks dropped to stay under the size limit
+    int64_t bytes_cached;   ///< bytes returned from cached blocks
+    int64_t bytes_loaded;   ///< bytes read from the underlying inputs
+    int64_t size;           ///< current size of the cached blocks
+    int nb_blocks;          ///< current number of cached blocks
+} AVIOCacheStats;
+
+/**
+ * @param max_size   upper bound of the cached data in bytes
+ * @param block_size size of a block, also the unit read from the input
+ * @return the cache, NULL on error
+ */
+AVIOCache *avio_cache_alloc(int64_t max_size, int block_size);
+
+/**
+ * Free the cache. All AVIOContexts using it must be closed first.
+ */
+void avio_cache_free(AVIOCache **cache);
+
+/**
+ * Open url for reading through the cache, the result can be used as
+ * AVFormatContext.pb like any custom AVIOContext.
+ *
+ * @param buffer_size size of the AVIOContext buffer, 0 for the block size
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int avio_cache_open(AVIOContext **pb, AVIOCache *cache, const char *url, int buffer_size);
+
+/**
+ * Close an AVIOContext opened with avio_cache_open(), its blocks stay cached.
+ */
+void avio_cache_close(AVIOContext **pb);
+
+void avio_cache_get_stats(AVIOCache *cache, AVIOCacheStats *stats);
+
+/**
+ * Print the hit rate and the other counters, to size the cache.
+ */
+void avio_cache_dump(AVIOCache *cache, FILE *out);
+
+#endif /* LEARNFFMPEG_AVIO_CACHE_H */
@@ -0,0 +1,309 @@
+#include "avio_readahead.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+typedef struct ReadaheadBlock {
+    int64_t pos;
+    int size;
+    uint8_t *data;
+} ReadaheadBlock;
+
+/* ring[head] .. ring[head + count - 1] hold consecutive data starting at or
+ * before read_pos; the helper thread fills ring[head + count] with the data
+ * at fetch_pos. A seek that leaves the window bumps generation, so a block
+ * the helper was reading for the old position is thrown away */
+typedef struct Readahead {
+    AVIOContext *source;
+    int own_source;
+    int block_size;
+    int window;
+    ReadaheadBlock *ring;
+    int head;
+    int count;
+    int64_t read_pos;
+    int64_t fetch_pos;
+    int64_t size;
+    int generation;
+    int eof;
+    int err;
+    int abort;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AVIOReadaheadStats stats;
+} Readahead;
+
+static void *readahead_thread(void *arg) {
+    Readahead *r = arg;
+    ReadaheadBlock *block;
+    int64_t pos;
+    int gen, ret;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->abort && (r->count == r->window || r->eof || r->err))
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->abort)
+            break;
+        block = &r->ring[(r->head + r->count) % r->window];
+        pos = r->fetch_pos;
+        gen = r->generation;
+        pthread_mutex_unlock(&r->lock);
+
+        /* the slot being filled is never one the reader looks at */
+        ret = 0;
+        if (avio_tell(r->source) != pos)
+            ret = avio_seek(r->source, pos, SEEK_SET);
+        if (ret >= 0)
+            ret = avio_read(r->source, block->data, r->block_size);
+
+        pthread_mutex_lock(&r->lock);
+        if (gen != r->generation)
+            continue;
+        if (ret == AVERROR_EOF || ret == 0) {
+            r->eof = 1;
+        } else if (ret < 0) {
+            r->err = ret;
+        } else {
+            block->pos = pos;
+            block->size = ret;
+            r->count++;
+            r->fetch_pos += ret;
+            r->stats.blocks++;
+        }
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+/* called with the lock held: drop the window and prefetch from read_pos */
+static void restart(Readahead *r) {
+    r->stats.discarded += r->count;
+    r->count = 0;
+    r->fetch_pos = r->read_pos;
+    r->generation++;
+    r->eof = 0;
+    r->err = 0;
+    pthread_cond_broadcast(&r->cond);
+}
+
+static int readahead_read(void *opaque, uint8_t *buf, int buf_size) {
+    Readahead *r = opaque;
+    ReadaheadBlock *b;
+    int64_t wait_start = 0;
+    int ret;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        /* blocks entirely before the position are done, their slots go back
+         * to the helper thread */
+        while (r->count && r->ring[r->head].pos + r->ring[r->head].size <= r->read_pos) {
+            r->head = (r->head + 1) % r->window;
+            r->count--;
+            pthread_cond_broadcast(&r->cond);
+        }
+        if (r->count) {
+            b = &r->ring[r->head];
+            if (b->pos <= r->read_pos) {
+                int offset = r->read_pos - b->pos;
+
+                ret = FFMIN(buf_size, b->size - offset);
+                memcpy(buf, b->data + offset, ret);
+                r->read_pos += ret;
+                break;
+            }
+            restart(r);
+        } else if (r->fetch_pos != r->read_pos) {
+            restart(r);
+        } else if (r->err) {
+            ret = r->err;
+            break;
+        } else if (r->eof) {
+            ret = AVERROR_EOF;
+            break;
+        }
+        if (!wait_start) {
+            wait_start = av_gettime_relative();
+            r->stats.stalls++;
+        }
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    if (wait_start)
+        r->stats.stall_time += av_gettime_relative() - wait_start;
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/* only moves the position, the next read decides whether the window is kept */
+static int64_t readahead_seek(void *opaque, int64_t offset, int whence) {
+    Readahead *r = opaque;
+    int64_t pos;
+
+    pthread_mutex_lock(&r->lock);
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            pos = r->size >= 0 ? r->size : AVERROR(ENOSYS);
+            pthread_mutex_unlock(&r->lock);
+            return pos;
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = r->read_pos + offset;
+            break;
+        case SEEK_END:
+            pos = r->size >= 0 ? r->size + offset : -1;
+            break;
+        default:
+            pos = -1;
+            break;
+    }
+    if (pos >= 0)
+        r->read_pos = pos;
+    pthread_mutex_unlock(&r->lock);
+    return pos >= 0 ? pos : AVERROR(EINVAL);
+}
+
+static void readahead_free(Readahead *r) {
+    int i;
+
+    if (r->ring)
+        for (i = 0; i < r->window; i++)
+            av_free(r->ring[i].data);
+    av_free(r->ring);
+    if (r->own_source)
+        avio_closep(&r->source);
+    av_free(r);
+}
+
+int avio_readahead_wrap(AVIOContext **pb, AVIOContext *source, int block_size, int window) {
+    Readahead *r;
+    uint8_t *buffer = NULL;
+    int i, ret = AVERROR(ENOMEM);
+
+    *pb = NULL;
+    if (block_size <= 0 || window <= 0)
+        return AVERROR(EINVAL);
+    r = av_mallocz(sizeof(*r));
+    if (!r)
+        return AVERROR(ENOMEM);
+    r->source = source;
+    r->block_size = block_size;
+    r->window = window;
+    /* the size is taken now, once the helper thread runs only it may touch
+     * the source */
+    r->size = avio_size(source);
+
+    r->ring = av_mallocz_array(window, sizeof(*r->ring));
+    if (!r->ring)
+        goto fail;
+    for (i = 0; i < window; i++)
+        if (!(r->ring[i].data = av_malloc(block_size)))
+            goto fail;
+    buffer = av_malloc(block_size);
+    if (!buffer)
+        goto fail;
+    *pb = avio_alloc_context(buffer, block_size, 0, r, readahead_read, NULL, readahead_seek);
+    if (!*pb)
+        goto fail;
+
+    if (pthread_mutex_init(&r->lock, NULL))
+        goto fail;
+    if (pthread_cond_init(&r->cond, NULL)) {
+        pthread_mutex_destroy(&r->lock);
+        goto fail;
+    }
+    if ((ret = pthread_create(&r->thread, NULL, readahead_thread, r))) {
+        ret = AVERROR(ret);
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    avio_context_free(pb);
+    av_free(buffer);
+    r->own_source = 0;
+    readahead_free(r);
+    return ret;
+}
+
+int avio_readahead_open(AVIOContext **pb, const char *url, int block_size, int window) {
+    AVIOContext *source = NULL;
+    int ret;
+
+    if ((ret = avio_open(&source, url, AVIO_FLAG_READ)) < 0)
+        return ret;
+    if ((ret = avio_readahead_wrap(pb, source, block_size, window)) < 0) {
+        avio_closep(&source);
+        return ret;
+    }
+    ((Readahead *) (*pb)->opaque)->own_source = 1;
+    return 0;
+}
+
+void avio_readahead_close(AVIOContext **pb) {
+    Readahead *r;
+
+    if (!*pb)
+        return;
+    r = (*pb)->opaque;
+    pthread_mutex_lock(&r->lock);
+    r->abort = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    readahead_free(r);
+
+    /* the internal buffer could have been reallocated by avio */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+int avio_readahead_open_input(AVFormatContext **fmt_ctx, const char *url, int readahead) {
+    AVIOContext *pb = NULL;
+    int ret;
+
+    if (!readahead)
+        return avformat_open_input(fmt_ctx, url, NULL, NULL);
+
+    if ((ret = avio_readahead_open(&pb, url, AVIO_READAHEAD_BLOCK_SIZE, AVIO_READAHEAD_WINDOW)) < 0)
+        return ret;
+    if (!*fmt_ctx && !(*fmt_ctx = avformat_alloc_context())) {
+        avio_readahead_close(&pb);
+        return AVERROR(ENOMEM);
+    }
+    (*fmt_ctx)->pb = pb;
+    (*fmt_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    /* the url still names the input for the probe and the log */
+    if ((ret = avformat_open_input(fmt_ctx, url, NULL, NULL)) < 0)
+        avio_readahead_close(&pb);
+    return ret;
+}
+
+void avio_readahead_close_input(AVFormatContext **fmt_ctx) {
+    AVIOContext *pb = NULL;
+
+    if (*fmt_ctx && (*fmt_ctx)->flags & AVFMT_FLAG_CUSTOM_IO)
+        pb = (*fmt_ctx)->pb;
+    avformat_close_input(fmt_ctx);
+    avio_readahead_close(&pb);
+}
+
+void avio_readahead_get_stats(AVIOContext *pb, AVIOReadaheadStats *stats) {
+    Readahead *r = pb->opaque;
+
+    pthread_mutex_lock(&r->lock);
+    *stats = r->stats;
+    pthread_mutex_unlock(&r->lock);
+}
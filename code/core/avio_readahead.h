@@ -0,0 +1,68 @@
+/**
+ * @file
+ * AVIOContext that prefetches its input on a helper thread.
+ *
+ * The helper thread reads the blocks following the current position into a
+ * ring of buffers while the demuxer works on the data already there, so a
+ * demuxer reading sequentially only waits for storage when it is faster than
+ * the storage itself. A seek inside the prefetched window keeps the blocks,
+ * a seek outside of it drops them and restarts the prefetch at the new
+ * position.
+ */
+
+#ifndef LEARNFFMPEG_AVIO_READAHEAD_H
+#define LEARNFFMPEG_AVIO_READAHEAD_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+
+/* block size and window of the examples' -readahead option */
+#define AVIO_READAHEAD_BLOCK_SIZE 65536
+#define AVIO_READAHEAD_WINDOW     8
+
+typedef struct AVIOReadaheadStats {
+    int64_t blocks;         ///< blocks read by the helper thread
+    int64_t stalls;         ///< reads that had to wait for the helper thread
+    int64_t stall_time;     ///< time spent waiting, in microseconds
+    int64_t discarded;      ///< prefetched blocks dropped by seeks
+} AVIOReadaheadStats;
+
+/**
+ * Prefetch from source, which must stay open until avio_readahead_close().
+ * From then on source is only used by the helper thread.
+ *
+ * @param block_size size of one read from source
+ * @param window     number of blocks read ahead of the current position
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int avio_readahead_wrap(AVIOContext **pb, AVIOContext *source, int block_size, int window);
+
+/**
+ * Open url with avio_open() and prefetch from it, the input is closed with
+ * the returned context.
+ */
+int avio_readahead_open(AVIOContext **pb, const char *url, int block_size, int window);
+
+/**
+ * Stop the helper thread and free the context (and the input it opened).
+ */
+void avio_readahead_close(AVIOContext **pb);
+
+/**
+ * avformat_open_input() on url, through a readahead context when readahead
+ * is set (AVFMT_FLAG_CUSTOM_IO), with the default block size and window.
+ * Close the input with avio_readahead_close_input().
+ */
+int avio_readahead_open_input(AVFormatContext **fmt_ctx, const char *url, int readahead);
+
+/**
+ * avformat_close_input(), and the readahead context of an input opened by
+ * avio_readahead_open_input().
+ */
+void avio_readahead_close_input(AVFormatContext **fmt_ctx);
+
+void avio_readahead_get_stats(AVIOContext *pb, AVIOReadaheadStats *stats);
+
+#endif /* LEARNFFMPEG_AVIO_READAHEAD_H */
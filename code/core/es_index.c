@@ -0,0 +1,383 @@
+#include "es_index.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/file.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+
+#include "annexb.h"
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+#define ES_INDEX_MAGIC   MKTAG('E', 'S', 'I', 'X')
+#define ES_INDEX_VERSION 1
+
+/* sizes of the records in the sidecar */
+#define HEADER_SIZE    36
+#define KEYFRAME_SIZE  20
+#define PARAM_SET_SIZE 16
+
+/* H.264 NAL unit types */
+#define H264_NAL_IDR_SLICE 5
+#define H264_NAL_SPS       7
+#define H264_NAL_PPS       8
+
+/* HEVC NAL unit types */
+#define HEVC_NAL_BLA_W_LP   16
+#define HEVC_NAL_RSV_IRAP23 23
+#define HEVC_NAL_VPS        32
+#define HEVC_NAL_SPS        33
+#define HEVC_NAL_PPS        34
+#define HEVC_NAL_AUD        35
+#define HEVC_NAL_SEI_PREFIX 39
+
+/* id of a parameter set, payload starts after the NAL unit header */
+static int param_set_id(enum AVCodecID codec_id, int type, const uint8_t *payload, size_t size) {
+    AnnexBBitReader br = {.data = payload, .size = size};
+    int max_sub_layers, profile_present[8], level_present[8], i;
+
+    if (codec_id == AV_CODEC_ID_H264) {
+        if (type == H264_NAL_SPS)
+            annexb_read_bits(&br, 24);     /* profile_idc, constraint flags, level_idc */
+        return annexb_read_ue(&br);
+    }
+
+    if (type == HEVC_NAL_VPS)
+        return annexb_read_bits(&br, 4);
+    if (type == HEVC_NAL_PPS)
+        return annexb_read_ue(&br);
+
+    /* SPS: the id follows the profile_tier_level() structure */
+    annexb_read_bits(&br, 4);               /* sps_video_parameter_set_id */
+    max_sub_layers = annexb_read_bits(&br, 3) + 1;
+    annexb_read_bits(&br, 1);               /* sps_temporal_id_nesting_flag */
+    annexb_read_bits(&br, 8);               /* general_profile_space, tier and idc */
+    annexb_read_bits(&br, 32);              /* general_profile_compatibility_flags */
+    annexb_read_bits(&br, 32);              /* 48 bits of source and constraint flags */
+    annexb_read_bits(&br, 16);
+    annexb_read_bits(&br, 8);               /* general_level_idc */
+    for (i = 0; i < max_sub_layers - 1; i++) {
+        profile_present[i] = annexb_read_bit(&br);
+        level_present[i] = annexb_read_bit(&br);
+    }
+    if (max_sub_layers > 1)
+        annexb_read_bits(&br, 2 * (9 - max_sub_layers));
+    for (i = 0; i < max_sub_layers - 1; i++) {
+        if (profile_present[i]) {
+            annexb_read_bits(&br, 32);
+            annexb_read_bits(&br, 32);
+            annexb_read_bits(&br, 24);
+        }
+        if (level_present[i])
+            annexb_read_bits(&br, 8);
+    }
+    return annexb_read_ue(&br);
+}
+
+/* offset of the next 00 00 01 at or after pos, size if there is none */
+static size_t find_start_code(const uint8_t *data, size_t size, size_t pos) {
+    return pos < size ? (size_t) (annexb_find_start_code(data + pos, data + size) - data) : size;
+}
+
+static int add_keyframe(ESIndex *idx, unsigned *allocated, int64_t pos, int nal_type) {
+    ESIndexEntry *e;
+
+    e = av_fast_realloc(idx->keyframes, allocated, (idx->nb_keyframes + 1) * sizeof(*e));
+    if (!e)
+        return AVERROR(ENOMEM);
+    idx->keyframes = e;
+    e = &idx->keyframes[idx->nb_keyframes++];
+    e->pos = pos;
+    e->frame = idx->nb_frames;
+    e->nal_type = nal_type;
+    return 0;
+}
+
+static int add_param_set(ESIndex *idx, unsigned *allocated, int64_t pos, int size,
+                         int nal_type, int id) {
+    ESParamSet *ps;
+
+    ps = av_fast_realloc(idx->param_sets, allocated, (idx->nb_param_sets + 1) * sizeof(*ps));
+    if (!ps)
+        return AVERROR(ENOMEM);
+    idx->param_sets = ps;
+    ps = &idx->param_sets[idx->nb_param_sets++];
+    ps->pos = pos;
+    ps->size = size;
+    ps->nal_type = nal_type;
+    ps->id = id;
+    return 0;
+}
+
+int es_index_build(ESIndex **pidx, const uint8_t *data, size_t size, enum AVCodecID codec_id) {
+    int h264 = codec_id == AV_CODEC_ID_H264;
+    size_t sc, next_sc, start, nal, end;
+    int64_t au_start = -1;
+    unsigned keyframes_allocated = 0, param_sets_allocated = 0;
+    ESIndex *idx;
+    int type, vcl, first_slice, ret = 0;
+
+    *pidx = NULL;
+    if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+        return AVERROR(EINVAL);
+    idx = av_mallocz(sizeof(*idx));
+    if (!idx)
+        return AVERROR(ENOMEM);
+    idx->codec_id = codec_id;
+    idx->file_size = size;
+
+    for (sc = find_start_code(data, size, 0); sc < size && ret >= 0; sc = next_sc) {
+        nal = sc + 3;
+        next_sc = find_start_code(data, size, nal);
+        /* the zero byte of a 4 byte start code belongs to the NAL unit after it */
+        start = sc && !data[sc - 1] ? sc - 1 : sc;
+        end = next_sc < size && next_sc > nal && !data[next_sc - 1] ? next_sc - 1 : next_sc;
+        if (nal + (h264 ? 2 : 3) > end)
+            continue;
+
+        if (h264) {
+            type = data[nal] & 0x1f;
+            vcl = type >= 1 && type <= 5;
+            first_slice = data[nal + 1] & 0x80;     /* first_mb_in_slice == 0 */
+        } else {
+            type = data[nal] >> 1 & 0x3f;
+            vcl = type < 32;
+            first_slice = data[nal + 2] & 0x80;     /* first_slice_segment_in_pic_flag */
+        }
+
+        if (vcl) {
+            if (first_slice) {
+                /* the access unit starts with the AUD, SEI or parameter sets
+                 * in front of its first slice */
+                if (h264 ? type == H264_NAL_IDR_SLICE
+                         : type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_RSV_IRAP23)
+                    ret = add_keyframe(idx, &keyframes_allocated,
+                                       au_start >= 0 ? au_start : (int64_t) start, type);
+                idx->nb_frames++;
+            }
+            au_start = -1;
+            continue;
+        }
+
+        if (h264 ? type == H264_NAL_SPS || type == H264_NAL_PPS
+                 : type >= HEVC_NAL_VPS && type <= HEVC_NAL_PPS)
+            ret = add_param_set(idx, &param_sets_allocated, start, end - start, type,
+                                param_set_id(codec_id, type, data + nal + (h264 ? 1 : 2),
+                                             end - nal - (h264 ? 1 : 2)));
+        /* SEI, parameter sets and AUD open an access unit, the other non-VCL
+         * NAL units end one */
+        if (au_start < 0 && (h264 ? type >= 6 && type <= 9
+                                  : (type >= HEVC_NAL_VPS && type <= HEVC_NAL_AUD) ||
+                                    type == HEVC_NAL_SEI_PREFIX))
+            au_start = start;
+    }
+
+    if (ret < 0) {
+        es_index_free(&idx);
+        return ret;
+    }
+    *pidx = idx;
+    return 0;
+}
+
+int es_index_build_file(ESIndex **idx, const char *filename, enum AVCodecID codec_id) {
+    uint8_t *data;
+    size_t size;
+    int ret;
+
+    *idx = NULL;
+    if ((ret = av_file_map(filename, &data, &size, 0, NULL)) < 0)
+        return ret;
+    ret = es_index_build(idx, data, size, codec_id);
+    av_file_unmap(data, size);
+    return ret;
+}
+
+int es_index_write(const ESIndex *idx, const char *filename) {
+    uint8_t buf[HEADER_SIZE], *p;
+    FILE *f = fopen(filename, "wb");
+    int i, ret = 0;
+
+    if (!f)
+        return AVERROR(errno);
+
+    AV_WL32(buf, ES_INDEX_MAGIC);
+    AV_WL32(buf + 4, ES_INDEX_VERSION);
+    AV_WL32(buf + 8, idx->codec_id == AV_CODEC_ID_HEVC ? 265 : 264);
+    AV_WL64(buf + 12, idx->file_size);
+    AV_WL64(buf + 20, idx->nb_frames);
+    AV_WL32(buf + 28, idx->nb_keyframes);
+    AV_WL32(buf + 32, idx->nb_param_sets);
+    if (fwrite(buf, HEADER_SIZE, 1, f) != 1)
+        ret = AVERROR(EIO);
+
+    for (i = 0; i < idx->nb_keyframes && ret >= 0; i++) {
+        p = buf;
+        AV_WL64(p, idx->keyframes[i].pos);
+        AV_WL64(p + 8, idx->keyframes[i].frame);
+        AV_WL32(p + 16, idx->keyframes[i].nal_type);
+        if (fwrite(buf, KEYFRAME_SIZE, 1, f) != 1)
+            ret = AVERROR(EIO);
+    }
+    for (i = 0; i < idx->nb_param_sets && ret >= 0; i++) {
+        p = buf;
+        AV_WL64(p, idx->param_sets[i].pos);
+        AV_WL32(p + 8, idx->param_sets[i].size);
+        AV_WL16(p + 12, idx->param_sets[i].nal_type);
+        AV_WL16(p + 14, idx->param_sets[i].id);
+        if (fwrite(buf, PARAM_SET_SIZE, 1, f) != 1)
+            ret = AVERROR(EIO);
+    }
+
+    if (fclose(f) && ret >= 0)
+        ret = AVERROR(EIO);
+    return ret;
+}
+
+int es_index_read(ESIndex **pidx, const char *filename) {
+    uint8_t buf[HEADER_SIZE];
+    ESIndex *idx = NULL;
+    FILE *f;
+    int i, ret = AVERROR_INVALIDDATA;
+
+    *pidx = NULL;
+    f = fopen(filename, "rb");
+    if (!f)
+        return AVERROR(errno);
+    if (fread(buf, HEADER_SIZE, 1, f) != 1 ||
+        AV_RL32(buf) != ES_INDEX_MAGIC || AV_RL32(buf + 4) != ES_INDEX_VERSION)
+        goto fail;
+
+    idx = av_mallocz(sizeof(*idx));
+    if (!idx) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    idx->codec_id = AV_RL32(buf + 8) == 265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    idx->file_size = AV_RL64(buf + 12);
+    idx->nb_frames = AV_RL64(buf + 20);
+    idx->nb_keyframes = AV_RL32(buf + 28);
+    idx->nb_param_sets = AV_RL32(buf + 32);
+    if (idx->nb_keyframes < 0 || idx->nb_param_sets < 0)
+        goto fail;
+    idx->keyframes = av_malloc_array(FFMAX(idx->nb_keyframes, 1), sizeof(*idx->keyframes));
+    idx->param_sets = av_malloc_array(FFMAX(idx->nb_param_sets, 1), sizeof(*idx->param_sets));
+    if (!idx->keyframes || !idx->param_sets) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    for (i = 0; i < idx->nb_keyframes; i++) {
+        if (fread(buf, KEYFRAME_SIZE, 1, f) != 1)
+            goto fail;
+        idx->keyframes[i].pos = AV_RL64(buf);
+        idx->keyframes[i].frame = AV_RL64(buf + 8);
+        idx->keyframes[i].nal_type = AV_RL32(buf + 16);
+    }
+    for (i = 0; i < idx->nb_param_sets; i++) {
+        if (fread(buf, PARAM_SET_SIZE, 1, f) != 1)
+            goto fail;
+        idx->param_sets[i].pos = AV_RL64(buf);
+        idx->param_sets[i].size = AV_RL32(buf + 8);
+        idx->param_sets[i].nal_type = AV_RL16(buf + 12);
+        idx->param_sets[i].id = AV_RL16(buf + 14);
+    }
+    fclose(f);
+    *pidx = idx;
+    return 0;
+
+    fail:
+    fclose(f);
+    es_index_free(&idx);
+    return ret;
+}
+
+int es_index_load(ESIndex **idx, const char *filename, enum AVCodecID codec_id) {
+    char *sidecar = av_asprintf("%s.idx", filename);
+    int64_t size = -1;
+    FILE *f;
+    int ret;
+
+    if (!sidecar)
+        return AVERROR(ENOMEM);
+    f = fopen(filename, "rb");
+    if (f) {
+        if (!fseeko(f, 0, SEEK_END))
+            size = ftello(f);
+        fclose(f);
+    }
+
+    ret = es_index_read(idx, sidecar);
+    if (ret >= 0 && ((*idx)->codec_id != codec_id || (*idx)->file_size != size))
+        es_index_free(idx);
+    if (!*idx) {
+        ret = es_index_build_file(idx, filename, codec_id);
+        /* the index is still usable when the sidecar cannot be written */
+        if (ret >= 0 && es_index_write(*idx, sidecar) < 0)
+            fprintf(stderr, "Could not write the index to %s\n", sidecar);
+    }
+    av_free(sidecar);
+    return ret;
+}
+
+const ESIndexEntry *es_index_seek(const ESIndex *idx, int64_t frame) {
+    int lo = 0, hi = idx->nb_keyframes - 1, mid;
+
+    if (!idx->nb_keyframes)
+        return NULL;
+    if (frame < idx->keyframes[0].frame)
+        return &idx->keyframes[0];
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (idx->keyframes[mid].frame <= frame)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return &idx->keyframes[lo];
+}
+
+int es_index_get_param_sets(const ESIndex *idx, const ESIndexEntry *entry,
+                            const ESParamSet **sets, int max_sets) {
+    const ESParamSet *ps, *tmp;
+    int i, j, n = 0;
+
+    for (i = 0; i < idx->nb_param_sets && idx->param_sets[i].pos < entry->pos; i++) {
+        ps = &idx->param_sets[i];
+        for (j = 0; j < n; j++)
+            if (sets[j]->nal_type == ps->nal_type && sets[j]->id == ps->id)
+                break;
+        if (j < n)
+            sets[j] = ps;
+        else if (n < max_sets)
+            sets[n++] = ps;
+    }
+
+    /* VPS before SPS before PPS, the NAL unit types are in that order */
+    for (i = 1; i < n; i++)
+        for (j = i; j > 0 && sets[j - 1]->nal_type > sets[j]->nal_type; j--) {
+            tmp = sets[j];
+            sets[j] = sets[j - 1];
+            sets[j - 1] = tmp;
+        }
+    return n;
+}
+
+void es_index_free(ESIndex **pidx) {
+    ESIndex *idx = *pidx;
+
+    if (!idx)
+        return;
+    av_free(idx->keyframes);
+    av_free(idx->param_sets);
+    av_freep(pidx);
+}
@@ -0,0 +1,84 @@
+/**
+ * @file
+ * Random access index of an H.264/HEVC elementary stream.
+ *
+ * The stream is scanned once for the access units that start with an IDR
+ * (H.264) or IRAP (HEVC) picture and for the parameter sets. The index is
+ * kept in a small binary sidecar file next to the stream, so later runs can
+ * start decoding at any GOP: feed the parameter sets in effect at a keyframe,
+ * then the stream from the keyframe offset on.
+ */
+
+#ifndef LEARNFFMPEG_ES_INDEX_H
+#define LEARNFFMPEG_ES_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+typedef struct ESIndexEntry {
+    int64_t pos;        ///< offset of the first byte of the access unit
+    int64_t frame;      ///< number of the picture in decoding order
+    int nal_type;       ///< type of the first slice NAL unit
+} ESIndexEntry;
+
+typedef struct ESParamSet {
+    int64_t pos;        ///< offset of the start code
+    int size;           ///< size with the start code, up to the next one
+    int nal_type;
+    int id;             ///< parameter set id, for telling apart sets of one type
+} ESParamSet;
+
+typedef struct ESIndex {
+    enum AVCodecID codec_id;
+    int64_t file_size;  ///< size of the indexed stream, to detect stale sidecars
+    int64_t nb_frames;
+    ESIndexEntry *keyframes;
+    int nb_keyframes;
+    ESParamSet *param_sets;
+    int nb_param_sets;
+} ESIndex;
+
+/**
+ * Index size bytes of Annex B data.
+ *
+ * @param codec_id AV_CODEC_ID_H264 or AV_CODEC_ID_HEVC
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int es_index_build(ESIndex **idx, const uint8_t *data, size_t size, enum AVCodecID codec_id);
+
+/**
+ * Map filename and index it.
+ */
+int es_index_build_file(ESIndex **idx, const char *filename, enum AVCodecID codec_id);
+
+int es_index_write(const ESIndex *idx, const char *filename);
+
+int es_index_read(ESIndex **idx, const char *filename);
+
+/**
+ * Read the sidecar of filename ("<filename>.idx"), or build the index and
+ * write the sidecar when there is none or it does not match the stream.
+ */
+int es_index_load(ESIndex **idx, const char *filename, enum AVCodecID codec_id);
+
+/**
+ * @return the last keyframe at or before the given picture (decoding order),
+ *         NULL if the stream has none
+ */
+const ESIndexEntry *es_index_seek(const ESIndex *idx, int64_t frame);
+
+/**
+ * Get the parameter sets that precede entry in the stream, the latest one of
+ * every type and id, ordered by type. Decoding can start at entry once they
+ * have been fed to the decoder.
+ *
+ * @return number of sets stored in sets, at most max_sets
+ */
+int es_index_get_param_sets(const ESIndex *idx, const ESIndexEntry *entry,
+                            const ESParamSet **sets, int max_sets);
+
+void es_index_free(ESIndex **idx);
+
+#endif /* LEARNFFMPEG_ES_INDEX_H */
@@ -0,0 +1,177 @@
+#include "media_util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+int media_check(int ret, const char *what) {
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", what, av_err2str(ret));
+        exit(1);
+    }
+    return ret;
+}
+
+FILE *media_fopen(const char *filename, const char *mode) {
+    FILE *f = fopen(filename, mode);
+
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(1);
+    }
+    return f;
+}
+
+int media_open_stream_decoder(AVFormatContext *fmt_ctx, enum AVMediaType type,
+                              AVCodecContext **dec_ctx, AVDictionary **opts) {
+    AVCodec *dec = NULL;
+    AVCodecContext *c;
+    int ret, stream_index;
+
+    ret = av_find_best_stream(fmt_ctx, type, -1, -1, &dec, 0);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find a %s stream in the input file\n",
+               av_get_media_type_string(type));
+        return ret;
+    }
+    stream_index = ret;
+
+    c = avcodec_alloc_context3(dec);
+    if (!c)
+        return AVERROR(ENOMEM);
+
+    ret = avcodec_parameters_to_context(c, fmt_ctx->streams[stream_index]->codecpar);
+    if (ret >= 0)
+        ret = avcodec_open2(c, dec, opts);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s decoder\n", av_get_media_type_string(type));
+        avcodec_free_context(&c);
+        return ret;
+    }
+
+    *dec_ctx = c;
+    return stream_index;
+}
+
+AVFrame *media_alloc_video_frame(enum AVPixelFormat pix_fmt, int width, int height, int align) {
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame)
+        return NULL;
+
+    frame->format = pix_fmt;
+    frame->width = width;
+    frame->height = height;
+
+    if (av_frame_get_buffer(frame, align) < 0)
+        av_frame_free(&frame);
+    return frame;
+}
+
+AVFrame *media_alloc_audio_frame(enum AVSampleFormat sample_fmt, uint64_t channel_layout,
+                                 int sample_rate, int nb_samples) {
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame)
+        return NULL;
+
+    frame->format = sample_fmt;
+    frame->channel_layout = channel_layout;
+    frame->sample_rate = sample_rate;
+    frame->nb_samples = nb_samples;
+
+    if (nb_samples && av_frame_get_buffer(frame, 0) < 0)
+        av_frame_free(&frame);
+    return frame;
+}
+
+#ifndef _WIN32
+/* rows are handed to the kernel in batches of this many spans */
+#define WRITE_BATCH 128
+
+/* write all of iov, resuming after short writes */
+static int write_spans(int fd, struct iovec *iov, int n) {
+    ssize_t ret;
+
+    while (n > 0) {
+        ret = writev(fd, iov, n);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(EIO);
+        }
+        while (n > 0 && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+#endif
+
+int media_write_video_frame(FILE *f, const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int linesize[4], i, y, h;
+#ifndef _WIN32
+    struct iovec iov[WRITE_BATCH];
+    int n = 0, fd = fileno(f);
+#endif
+
+    if (!desc || av_image_fill_linesizes(linesize, frame->format, frame->width) < 0)
+        return AVERROR(EINVAL);
+#ifndef _WIN32
+    /* the rows go to the file descriptor, behind what stdio still holds */
+    if (fflush(f))
+        return AVERROR(EIO);
+#endif
+
+    for (i = 0; i < 4 && frame->data[i] && linesize[i]; i++) {
+        h = frame->height;
+        if (i == 1 || i == 2)
+            h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
+#ifndef _WIN32
+        /* straight from the decoder's buffers: one span for a padding-free
+         * plane, one per row otherwise */
+        for (y = 0; y < h; y++) {
+            if (n == WRITE_BATCH) {
+                if (write_spans(fd, iov, n) < 0)
+                    return AVERROR(EIO);
+                n = 0;
+            }
+            iov[n].iov_base = frame->data[i] + (ptrdiff_t) frame->linesize[i] * y;
+            if (frame->linesize[i] == linesize[i]) {
+                iov[n++].iov_len = (size_t) linesize[i] * h;
+                break;
+            }
+            iov[n++].iov_len = linesize[i];
+        }
+#else
+        /* padding-free planes go out in one call */
+        if (frame->linesize[i] == linesize[i]) {
+            if (fwrite(frame->data[i], linesize[i], h, f) != (size_t) h)
+                return AVERROR(EIO);
+            continue;
+        }
+        for (y = 0; y < h; y++)
+            if (fwrite(frame->data[i] + (ptrdiff_t) frame->linesize[i] * y, 1, linesize[i], f)
+                != (size_t) linesize[i])
+                return AVERROR(EIO);
+#endif
+    }
+#ifndef _WIN32
+    if (write_spans(fd, iov, n) < 0)
+        return AVERROR(EIO);
+#endif
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file
+ * Small helpers shared by the examples: opening files and decoders,
+ * allocating frames and writing raw pictures.
+ *
+ * They follow the conventions of the examples they were taken from: the
+ * media_*() functions return a negative AVERROR or NULL on failure and leave
+ * the reporting to the caller, media_fopen() and media_check() are for the
+ * examples that simply give up with exit(1).
+ */
+
+#ifndef LEARNFFMPEG_MEDIA_UTIL_H
+#define LEARNFFMPEG_MEDIA_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+
+/**
+ * Print "what: <error string>" and exit(1) if ret is negative.
+ *
+ * @return ret, so it can wrap a call: n = media_check(av_read_frame(...), "...")
+ */
+int media_check(int ret, const char *what);
+
+/**
+ * fopen() that prints the file name and exits on failure.
+ */
+FILE *media_fopen(const char *filename, const char *mode);
+
+/**
+ * Find the best stream of the given type in fmt_ctx and open a decoder for it,
+ * with the stream parameters copied into the context.
+ *
+ * @param opts decoder options, may be NULL; consumed options are removed
+ * @return the stream index, a negative AVERROR on failure
+ */
+int media_open_stream_decoder(AVFormatContext *fmt_ctx, enum AVMediaType type,
+                              AVCodecContext **dec_ctx, AVDictionary **opts);
+
+/**
+ * Allocate a video frame with buffers for pix_fmt/width/height.
+ *
+ * @param align buffer alignment, 0 for the libavutil default
+ */
+AVFrame *media_alloc_video_frame(enum AVPixelFormat pix_fmt, int width, int height, int align);
+
+/**
+ * Allocate an audio frame. Buffers are only allocated when nb_samples is not 0.
+ */
+AVFrame *media_alloc_audio_frame(enum AVSampleFormat sample_fmt, uint64_t channel_layout,
+                                 int sample_rate, int nb_samples);
+
+/**
+ * Write the visible part of every plane of a video frame, without the
+ * linesize padding, so the output can be played as raw video.
+ *
+ * The rows are written straight from the frame with writev() (fwrite() on
+ * Windows), after flushing f; nothing is copied into an intermediate buffer.
+ *
+ * @return 0 on success, AVERROR(EIO) if a write failed
+ */
+int media_write_video_frame(FILE *f, const AVFrame *frame);
+
+#endif /* LEARNFFMPEG_MEDIA_UTIL_H */
@@ -0,0 +1,165 @@
+#include "stage_timer.h"
+
+#ifdef LEARNFFMPEG_STAGE_TIMING
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* bucket 0 counts calls under 1us, bucket n calls in [2^(n-1), 2^n) us */
+#define NB_BUCKETS 32
+
+typedef struct StageCounters {
+    int64_t count;
+    int64_t total;
+    int64_t max;
+    int64_t hist[NB_BUCKETS];
+} StageCounters;
+
+typedef struct ThreadTimers {
+    StageCounters stage[TIMED_NB];
+    int index;
+    struct ThreadTimers *next;
+} ThreadTimers;
+
+static const char *const stage_names[TIMED_NB] = {
+        [TIMED_DEMUX]          = "demux",
+        [TIMED_DECODE_SEND]    = "decode send",
+        [TIMED_DECODE_RECEIVE] = "decode receive",
+        [TIMED_FILTER_SRC]     = "filter src",
+        [TIMED_FILTER_SINK]    = "filter sink",
+        [TIMED_ENCODE_SEND]    = "encode send",
+        [TIMED_ENCODE_RECEIVE] = "encode receive",
+        [TIMED_MUX]            = "mux",
+};
+
+/* every thread updates its own counters without locking; the list of them is
+ * only locked to register a new thread and to print the summary */
+static THREAD_LOCAL ThreadTimers *thread_timers;
+static ThreadTimers *all_timers;
+static int nb_threads;
+static pthread_mutex_t timers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ThreadTimers *register_thread(void) {
+    ThreadTimers *t = av_mallocz(sizeof(*t));
+
+    if (!t)
+        return NULL;
+    pthread_mutex_lock(&timers_lock);
+    if (!all_timers)
+        atexit(stage_timer_dump);
+    t->index = nb_threads++;
+    t->next = all_timers;
+    all_timers = t;
+    pthread_mutex_unlock(&timers_lock);
+    return t;
+}
+
+void stage_timer_add(enum TimedStage stage, int64_t elapsed) {
+    StageCounters *c;
+
+    if (!thread_timers && !(thread_timers = register_thread()))
+        return;
+    c = &thread_timers->stage[stage];
+    c->count++;
+    c->total += elapsed;
+    c->max = FFMAX(c->max, elapsed);
+    c->hist[elapsed > 0 ? FFMIN(av_log2(elapsed) + 1, NB_BUCKETS - 1) : 0]++;
+}
+
+void stage_timer_dump(void) {
+    StageCounters sum[TIMED_NB] = {{0}};
+    ThreadTimers *t;
+    int i, b;
+
+    pthread_mutex_lock(&timers_lock);
+    if (!all_timers) {
+        pthread_mutex_unlock(&timers_lock);
+        return;
+    }
+
+    fprintf(stderr, "\nstage timing            calls    total ms   avg us   max us\n");
+    for (t = all_timers; t; t = t->next) {
+        for (i = 0; i < TIMED_NB; i++) {
+            const StageCounters *c = &t->stage[i];
+            if (!c->count)
+                continue;
+            fprintf(stderr, "  thread %-2d %-14s %6"PRId64" %10.2f\n", t->index, stage_names[i],
+                    c->count, c->total / 1000.0);
+            sum[i].count += c->count;
+            sum[i].total += c->total;
+            sum[i].max = FFMAX(sum[i].max, c->max);
+            for (b = 0; b < NB_BUCKETS; b++)
+                sum[i].hist[b] += c->hist[b];
+        }
+    }
+    for (i = 0; i < TIMED_NB; i++) {
+        const StageCounters *c = &sum[i];
+        if (!c->count)
+            continue;
+        fprintf(stderr, "%-24s %6"PRId64" %10.2f %8.1f %8"PRId64"\n", stage_names[i],
+                c->count, c->total / 1000.0, (double) c->total / c->count, c->max);
+        fprintf(stderr, "    <us:");
+        for (b = 0; b < NB_BUCKETS; b++)
+            if (c->hist[b])
+                fprintf(stderr, " %"PRId64":%"PRId64, (int64_t) 1 << b, c->hist[b]);
+        fprintf(stderr, "\n");
+    }
+    pthread_mutex_unlock(&timers_lock);
+}
+
+#define TIMED_CALL(stage, call)                                 \
+    do {                                                        \
+        int64_t start = av_gettime_relative();                  \
+        int ret = call;                                         \
+        stage_timer_add(stage, av_gettime_relative() - start);  \
+        return ret;                                             \
+    } while (0)
+
+int timed_read_frame(AVFormatContext *s, AVPacket *pkt) {
+    TIMED_CALL(TIMED_DEMUX, av_read_frame(s, pkt));
+}
+
+int timed_send_packet(AVCodecContext *avctx, const AVPacket *avpkt) {
+    TIMED_CALL(TIMED_DECODE_SEND, avcodec_send_packet(avctx, avpkt));
+}
+
+int timed_receive_frame(AVCodecContext *avctx, AVFrame *frame) {
+    TIMED_CALL(TIMED_DECODE_RECEIVE, avcodec_receive_frame(avctx, frame));
+}
+
+int timed_send_frame(AVCodecContext *avctx, const AVFrame *frame) {
+    TIMED_CALL(TIMED_ENCODE_SEND, avcodec_send_frame(avctx, frame));
+}
+
+int timed_receive_packet(AVCodecContext *avctx, AVPacket *avpkt) {
+    TIMED_CALL(TIMED_ENCODE_RECEIVE, avcodec_receive_packet(avctx, avpkt));
+}
+
+int timed_buffersrc_add_frame_flags(AVFilterContext *ctx, AVFrame *frame, int flags) {
+    TIMED_CALL(TIMED_FILTER_SRC, av_buffersrc_add_frame_flags(ctx, frame, flags));
+}
+
+int timed_buffersink_get_frame(AVFilterContext *ctx, AVFrame *frame) {
+    TIMED_CALL(TIMED_FILTER_SINK, av_buffersink_get_frame(ctx, frame));
+}
+
+int timed_write_frame(AVFormatContext *s, AVPacket *pkt) {
+    TIMED_CALL(TIMED_MUX, av_write_frame(s, pkt));
+}
+
+int timed_interleaved_write_frame(AVFormatContext *s, AVPacket *pkt) {
+    TIMED_CALL(TIMED_MUX, av_interleaved_write_frame(s, pkt));
+}
+
+#endif /* LEARNFFMPEG_STAGE_TIMING */
@@ -0,0 +1,74 @@
+/**
+ * @file
+ * Per-stage timing of the demux/decode/filter/encode/mux calls.
+ *
+ * The timed_*() functions wrap the libavformat/libavcodec/libavfilter calls
+ * where the examples spend their time. When built with
+ * LEARNFFMPEG_STAGE_TIMING they add the duration of every call, measured on
+ * the monotonic clock, to per-thread counters with a log2 histogram, and a
+ * summary is printed to stderr at exit. Without it they are plain aliases of
+ * the wrapped functions and cost nothing.
+ */
+
+#ifndef LEARNFFMPEG_STAGE_TIMER_H
+#define LEARNFFMPEG_STAGE_TIMER_H
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+
+enum TimedStage {
+    TIMED_DEMUX,
+    TIMED_DECODE_SEND,
+    TIMED_DECODE_RECEIVE,
+    TIMED_FILTER_SRC,
+    TIMED_FILTER_SINK,
+    TIMED_ENCODE_SEND,
+    TIMED_ENCODE_RECEIVE,
+    TIMED_MUX,
+    TIMED_NB
+};
+
+#ifdef LEARNFFMPEG_STAGE_TIMING
+
+/**
+ * Account elapsed microseconds to stage on the calling thread.
+ */
+void stage_timer_add(enum TimedStage stage, int64_t elapsed);
+
+/**
+ * Print the summary of all threads to stderr. Registered with atexit() on
+ * first use, may be called earlier by the program.
+ */
+void stage_timer_dump(void);
+
+int timed_read_frame(AVFormatContext *s, AVPacket *pkt);
+int timed_send_packet(AVCodecContext *avctx, const AVPacket *avpkt);
+int timed_receive_frame(AVCodecContext *avctx, AVFrame *frame);
+int timed_send_frame(AVCodecContext *avctx, const AVFrame *frame);
+int timed_receive_packet(AVCodecContext *avctx, AVPacket *avpkt);
+int timed_buffersrc_add_frame_flags(AVFilterContext *ctx, AVFrame *frame, int flags);
+int timed_buffersink_get_frame(AVFilterContext *ctx, AVFrame *frame);
+int timed_write_frame(AVFormatContext *s, AVPacket *pkt);
+int timed_interleaved_write_frame(AVFormatContext *s, AVPacket *pkt);
+
+#else
+
+#define stage_timer_add(stage, elapsed) do { } while (0)
+#define stage_timer_dump() do { } while (0)
+
+#define timed_read_frame                av_read_frame
+#define timed_send_packet               avcodec_send_packet
+#define timed_receive_frame             avcodec_receive_frame
+#define timed_send_frame                avcodec_send_frame
+#define timed_receive_packet            avcodec_receive_packet
+#define timed_buffersrc_add_frame_flags av_buffersrc_add_frame_flags
+#define timed_buffersink_get_frame      av_buffersink_get_frame
+#define timed_write_frame               av_write_frame
+#define timed_interleaved_write_frame   av_interleaved_write_frame
+
+#endif /* LEARNFFMPEG_STAGE_TIMING */
+
+#endif /* LEARNFFMPEG_STAGE_TIMER_H */
@@ -0,0 +1,138 @@
+#include "yuv_frame_source.h"
+
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#endif
+
+YUVFrameSource *yuv_frame_source_open(const char *filename, enum AVPixelFormat pix_fmt,
+                                      int width, int height, int align) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    YUVFrameSource *src;
+    uint8_t *data[4];
+    int i, w, size;
+
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || align <= 0 || (align & (align - 1)))
+        return NULL;
+
+    src = av_mallocz(sizeof(*src));
+    if (!src)
+        return NULL;
+    src->pix_fmt = pix_fmt;
+    src->width = width;
+    src->height = height;
+    src->align = align;
+
+    /* pad the width until every linesize is a multiple of align, like
+     * av_frame_get_buffer() does */
+    for (w = 1; w <= align; w += w) {
+        if (av_image_fill_linesizes(src->linesize, pix_fmt, FFALIGN(width, w)) < 0)
+            goto fail;
+        for (i = 0; i < 4; i++)
+            if (src->linesize[i] % align)
+                break;
+        if (i == 4)
+            break;
+    }
+
+    /* with a NULL base the plane pointers come back as offsets */
+    size = av_image_fill_pointers(data, pix_fmt, height, NULL, src->linesize);
+    if (size < 0)
+        goto fail;
+    for (i = 0; i < 4 && src->linesize[i]; i++) {
+        int shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+
+        src->plane_offset[i] = (int) (intptr_t) data[i];
+        src->plane_height[i] = AV_CEIL_RSHIFT(height, shift);
+        src->row_size[i] = av_image_get_linesize(pix_fmt, width, i);
+    }
+    src->nb_planes = i;
+
+    /* av_malloc() only guarantees the alignment lavu was built with, so
+     * allocate enough to align the first plane by hand. Like the frames of
+     * av_frame_get_buffer(), the buffer is padded after the last plane so
+     * SIMD code may read past its end */
+    src->pool = av_buffer_pool_init(size + align - 1 + AV_INPUT_BUFFER_PADDING_SIZE, NULL);
+    if (!src->pool)
+        goto fail;
+
+    src->file = fopen(filename, "rb");
+    if (!src->file)
+        goto fail;
+
+    return src;
+
+    fail:
+    yuv_frame_source_close(&src);
+    return NULL;
+}
+
+int yuv_frame_source_read(YUVFrameSource *src, AVFrame *frame) {
+    AVBufferRef *buf;
+    uint8_t *base;
+    int i, y;
+
+    buf = av_buffer_pool_get(src->pool);
+    if (!buf)
+        return AVERROR(ENOMEM);
+    base = (uint8_t *) FFALIGN((uintptr_t) buf->data, (uintptr_t) src->align);
+
+    for (i = 0; i < src->nb_planes; i++) {
+        uint8_t *dst = base + src->plane_offset[i];
+
+        if (src->linesize[i] == src->row_size[i]) {
+            size_t plane_size = (size_t) src->row_size[i] * src->plane_height[i];
+            if (fread(dst, 1, plane_size, src->file) != plane_size)
+                goto eof;
+        } else {
+            for (y = 0; y < src->plane_height[i]; y++)
+                if (fread(dst + (size_t) y * src->linesize[i], 1, src->row_size[i],
+                          src->file) != (size_t) src->row_size[i])
+                    goto eof;
+        }
+        frame->data[i] = dst;
+        frame->linesize[i] = src->linesize[i];
+    }
+
+    frame->buf[0] = buf;
+    frame->extended_data = frame->data;
+    frame->format = src->pix_fmt;
+    frame->width = src->width;
+    frame->height = src->height;
+    return 0;
+
+    eof:
+    av_buffer_unref(&buf);
+    memset(frame->data, 0, sizeof(frame->data));
+    return ferror(src->file) ? AVERROR(EIO) : AVERROR_EOF;
+}
+
+int yuv_frame_source_seek(YUVFrameSource *src, int64_t frame_index) {
+    int64_t frame_size = 0;
+    int i;
+
+    for (i = 0; i < src->nb_planes; i++)
+        frame_size += (int64_t) src->row_size[i] * src->plane_height[i];
+    if (frame_index < 0 || fseeko(src->file, frame_index * frame_size, SEEK_SET) < 0)
+        return AVERROR(EINVAL);
+    return 0;
+}
+
+void yuv_frame_source_close(YUVFrameSource **psrc) {
+    YUVFrameSource *src = *psrc;
+
+    if (!src)
+        return;
+    if (src->file)
+        fclose(src->file);
+    av_buffer_pool_uninit(&src->pool);
+    av_freep(psrc);
+}
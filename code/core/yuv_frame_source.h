@@ -0,0 +1,68 @@
+/**
+ * @file
+ * Raw YUV frame source backed by an AVBufferPool.
+ *
+ * Every picture read from the file lands in its own pooled, aligned buffer,
+ * so an encoder that keeps references to its input (lookahead, B-frames) never
+ * sees the data change under it. Once the encoder and the caller have dropped
+ * their references the buffer goes back to the pool and is reused for a later
+ * picture, without a new allocation or an av_frame_make_writable() copy.
+ */
+
+#ifndef LEARNFFMPEG_YUV_FRAME_SOURCE_H
+#define LEARNFFMPEG_YUV_FRAME_SOURCE_H
+
+#include <stdio.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+typedef struct YUVFrameSource {
+    FILE *file;
+    AVBufferPool *pool;
+    enum AVPixelFormat pix_fmt;
+    int width;
+    int height;
+    int align;
+    int linesize[4];
+    int plane_offset[4];
+    int plane_height[4];
+    int row_size[4];    ///< bytes of one row of each plane in the file
+    int nb_planes;
+} YUVFrameSource;
+
+/**
+ * Open a raw video file for reading.
+ *
+ * @param align alignment of the planes and linesizes, 32 or 64 for SIMD
+ * @return the source, NULL on error
+ */
+YUVFrameSource *yuv_frame_source_open(const char *filename, enum AVPixelFormat pix_fmt,
+                                      int width, int height, int align);
+
+/**
+ * Read the next picture into frame, which must be blank (freshly allocated
+ * or unreferenced). The caller unreferences it once it was sent to the encoder.
+ *
+ * @return 0 on success, AVERROR_EOF when no complete picture is left,
+ *         another negative AVERROR on failure
+ */
+int yuv_frame_source_read(YUVFrameSource *src, AVFrame *frame);
+
+/**
+ * Position the source so that the next read returns picture frame_index
+ * (counted from 0). Seeking past the end is not an error, the next read
+ * returns AVERROR_EOF.
+ *
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int yuv_frame_source_seek(YUVFrameSource *src, int64_t frame_index);
+
+/**
+ * Close the file and release the pool. Frames still referenced by an encoder
+ * stay valid, the pool is freed when the last one is released.
+ */
+void yuv_frame_source_close(YUVFrameSource **src);
+
+#endif /* LEARNFFMPEG_YUV_FRAME_SOURCE_H */
@@ -31,21 +31,152 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <libavutil/file.h>
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
+#include <libavutil/time.h>
 
 #include <libavcodec/avcodec.h>
 
+#include "core/stage_timer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define AUDIO_INBUF_SIZE 20480
 #define AUDIO_REFILL_THRESH 4096
 
+/* with -mmap only the last AUDIO_REFILL_THRESH bytes of the file are copied
+ * into the padded input buffer, the rest is parsed in place in the mapping */
+#define MMAP_TAIL_SIZE AUDIO_REFILL_THRESH
+
+/* packed samples are collected in one reusable block and written with a single
+ * fwrite once the next frame would not fit anymore */
+#define OUTPUT_BLOCK_SIZE (256 * 1024)
+
+static uint8_t *out_block;
+static unsigned int out_block_size;
+static size_t out_block_used;
+
+/* -legacy keeps the original fwrite per sample and channel for comparison */
+static int legacy_writer;
+static int64_t write_time;
+static int64_t bytes_written;
+
+/* stereo fast paths; the 32-bit one works on the sample bits as integers, so
+ * FLTP and S32P are both plain bit moves and no float register touches them */
+static void interleave_32_stereo(uint32_t *dst, const uint32_t *l, const uint32_t *r, int nb_samples) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 4 <= nb_samples; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (l + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (r + i));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi32(a, b));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i + 4), _mm_unpackhi_epi32(a, b));
+    }
+#endif
+    for (; i < nb_samples; i++) {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+}
+
+static void interleave_16_stereo(int16_t *dst, const int16_t *l, const int16_t *r, int nb_samples) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 8 <= nb_samples; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (l + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (r + i));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+    }
+#endif
+    for (; i < nb_samples; i++) {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+}
+
+#define INTERLEAVE_GENERIC(type)                                                \
+    do {                                                                        \
+        type *out = (type *) dst;                                               \
+        for (i = 0; i < nb_samples; i++)                                        \
+            for (ch = 0; ch < channels; ch++)                                   \
+                *out++ = ((const type *) src[ch])[i];                           \
+    } while (0)
+
+/* interleave planar samples into dst, which must hold nb_samples * channels samples */
+static void interleave_planes(uint8_t *dst, uint8_t **src, enum AVSampleFormat fmt,
+                              int channels, int nb_samples) {
+    int bps = av_get_bytes_per_sample(fmt);
+    int i, ch;
+
+    if (channels == 2 && (fmt == AV_SAMPLE_FMT_FLTP || fmt == AV_SAMPLE_FMT_S32P)) {
+        interleave_32_stereo((uint32_t *) dst, (const uint32_t *) src[0], (const uint32_t *) src[1],
+                             nb_samples);
+        return;
+    }
+    if (channels == 2 && fmt == AV_SAMPLE_FMT_S16P) {
+        interleave_16_stereo((int16_t *) dst, (const int16_t *) src[0], (const int16_t *) src[1], nb_samples);
+        return;
+    }
+
+    switch (bps) {
+        case 1:
+            INTERLEAVE_GENERIC(uint8_t);
+            break;
+        case 2:
+            INTERLEAVE_GENERIC(int16_t);
+            break;
+        case 4:
+            INTERLEAVE_GENERIC(int32_t);
+            break;
+        case 8:
+            INTERLEAVE_GENERIC(int64_t);
+            break;
+    }
+}
+
+static void flush_output(FILE *outfile) {
+    if (out_block_used)
+        fwrite(out_block, 1, out_block_used, outfile);
+    out_block_used = 0;
+}
+
+/* append one decoded frame to the output block as packed samples */
+static void write_packed(const AVFrame *frame, int channels, FILE *outfile) {
+    enum AVSampleFormat fmt = frame->format;
+    size_t size = (size_t) frame->nb_samples * channels * av_get_bytes_per_sample(fmt);
+
+    if (out_block_used + size > out_block_size)
+        flush_output(outfile);
+    if (size > out_block_size) {
+        av_fast_malloc(&out_block, &out_block_size, FFMAX(size, OUTPUT_BLOCK_SIZE));
+        if (!out_block) {
+            fprintf(stderr, "Could not allocate the output block\n");
+            exit(1);
+        }
+    }
+
+    if (av_sample_fmt_is_planar(fmt) && channels > 1)
+        interleave_planes(out_block + out_block_used, frame->extended_data, fmt,
+                          channels, frame->nb_samples);
+    else
+        memcpy(out_block + out_block_used, frame->extended_data[0], size);
+    out_block_used += size;
+}
+
 static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
                    FILE *outfile) {
     int i, ch;
     int ret, data_size;
+    int64_t t;
 
     /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(dec_ctx, pkt);
+    ret = timed_send_packet(dec_ctx, pkt);
     if (ret < 0) {
         fprintf(stderr, "Error submitting the packet to the decoder\n");
         exit(1);
@@ -53,7 +184,7 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
 
     /* read all the output frames (in general there may be any number of them */
     while (ret >= 0) {
-        ret = avcodec_receive_frame(dec_ctx, frame);
+        ret = timed_receive_frame(dec_ctx, frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return;
         else if (ret < 0) {
@@ -66,13 +197,55 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
             fprintf(stderr, "Failed to calculate data size\n");
             exit(1);
         }
-        for (i = 0; i < frame->nb_samples; i++)
-            for (ch = 0; ch < dec_ctx->channels; ch++)
-                fwrite(frame->data[ch] + data_size * i, 1, data_size, outfile);
+        t = av_gettime_relative();
+        if (legacy_writer) {
+            for (i = 0; i < frame->nb_samples; i++)
+                for (ch = 0; ch < dec_ctx->channels; ch++)
+                    fwrite(frame->data[ch] + data_size * i, 1, data_size, outfile);
+        } else {
+            write_packed(frame, dec_ctx->channels, outfile);
+        }
+        write_time += av_gettime_relative() - t;
+        bytes_written += (int64_t) frame->nb_samples * dec_ctx->channels * data_size;
     }
 }
 
-int main() {
+/*
+ * split data into packets with the parser and decode them; data_size 0 flushes
+ * the parser. Packets the parser returns in place inside src_buf are passed to
+ * the decoder as references to it instead of being copied
+ */
+static void parse_and_decode(AVCodecParserContext *parser, AVCodecContext *c,
+                             AVPacket *pkt, AVFrame *frame, AVBufferRef *src_buf,
+                             const uint8_t *data, size_t data_size, FILE *outfile) {
+    const uint8_t *data_end = data + data_size;
+    int ret;
+
+    do {
+        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+                               data, FFMIN(data_size, INT_MAX),
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (ret < 0) {
+            fprintf(stderr, "Error while parsing\n");
+            exit(1);
+        }
+        data += ret;
+        data_size -= ret;
+
+        if (pkt->size) {
+            if (src_buf && pkt->data >= src_buf->data && pkt->data + pkt->size <= data_end)
+                pkt->buf = src_buf;
+            decode(c, pkt, frame, outfile);
+            pkt->buf = NULL;
+        }
+    } while (data_size > 0);
+}
+
+static void mapped_buffer_free(void *opaque, uint8_t *data) {
+    /* the mapping is released with av_file_unmap() once the decoder is closed */
+}
+
+int main(int argc, char **argv) {
     const char *outfilename, *filename;
     const AVCodec *codec;
     AVCodecContext *c = NULL;
@@ -84,10 +257,33 @@ int main() {
     size_t data_size;
     AVPacket *pkt;
     AVFrame *decoded_frame = NULL;
+    int i, nb_inputs = 0;
+    int use_mmap = 0;
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    AVBufferRef *map_buf = NULL;
 
     filename = "../origin.aac";
     outfilename = "../decode_result.pcm";
 
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-mmap")) {
+            use_mmap = 1;
+        } else if (!strcmp(argv[i], "-legacy")) {
+            legacy_writer = 1;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-mmap] [-legacy] [input_file [output_file]]\n"
+                            "-mmap maps the input file and parses it in place.\n"
+                            "-legacy writes the output with one fwrite per sample and channel,\n"
+                            "to compare the output stage timing against the packed writer.\n", argv[0]);
+            exit(1);
+        } else if (nb_inputs++ == 0) {
+            filename = argv[i];
+        } else {
+            outfilename = argv[i];
+        }
+    }
+
     pkt = av_packet_alloc();
 
     /* find the aac audio decoder */
@@ -115,50 +311,73 @@ int main() {
         exit(1);
     }
 
-    f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Could not open %s\n", filename);
-        exit(1);
-    }
     outfile = fopen(outfilename, "wb");
     if (!outfile) {
         av_free(c);
         exit(1);
     }
 
-    /* decode until eof */
-    data = inbuf;
-    data_size = fread(inbuf, 1, AUDIO_INBUF_SIZE, f);
+    if (!(decoded_frame = av_frame_alloc())) {
+        fprintf(stderr, "Could not allocate audio frame\n");
+        exit(1);
+    }
 
-    while (data_size > 0) {
-        if (!decoded_frame) {
-            if (!(decoded_frame = av_frame_alloc())) {
-                fprintf(stderr, "Could not allocate audio frame\n");
-                exit(1);
-            }
+    if (use_mmap) {
+        if (av_file_map(filename, &map, &map_size, 0, NULL) < 0) {
+            fprintf(stderr, "Could not map %s\n", filename);
+            exit(1);
+        }
+        map_buf = av_buffer_create(map, FFMIN(map_size, INT_MAX), mapped_buffer_free,
+                                   NULL, AV_BUFFER_FLAG_READONLY);
+        if (!map_buf) {
+            fprintf(stderr, "Could not allocate buffer reference\n");
+            exit(1);
         }
 
-        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
-                               data, data_size,
-                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
-        if (ret < 0) {
-            fprintf(stderr, "Error while parsing\n");
+        data_size = map_size > MMAP_TAIL_SIZE ? map_size - MMAP_TAIL_SIZE : 0;
+        if (data_size)
+            parse_and_decode(parser, c, pkt, decoded_frame, map_buf, map, data_size, outfile);
+
+        /* the tail goes through the padded input buffer */
+        memcpy(inbuf, map + data_size, map_size - data_size);
+        memset(inbuf + map_size - data_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        parse_and_decode(parser, c, pkt, decoded_frame, NULL, inbuf, map_size - data_size, outfile);
+        parse_and_decode(parser, c, pkt, decoded_frame, NULL, NULL, 0, outfile);
+    } else {
+        f = fopen(filename, "rb");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", filename);
             exit(1);
         }
-        data += ret;
-        data_size -= ret;
 
-        if (pkt->size)
-            decode(c, pkt, decoded_frame, outfile);
+        /* decode until eof */
+        data = inbuf;
+        data_size = fread(inbuf, 1, AUDIO_INBUF_SIZE, f);
+
+        while (data_size > 0) {
+            ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+                                   data, data_size,
+                                   AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            if (ret < 0) {
+                fprintf(stderr, "Error while parsing\n");
+                exit(1);
+            }
+            data += ret;
+            data_size -= ret;
 
-        if (data_size < AUDIO_REFILL_THRESH) {
-            memmove(inbuf, data, data_size);
-            data = inbuf;
-            len = fread(data + data_size, 1,
-                        AUDIO_INBUF_SIZE - data_size, f);
-            if (len > 0)
-                data_size += len;
+            if (pkt->size)
+                decode(c, pkt, decoded_frame, outfile);
+
+            if (data_size < AUDIO_REFILL_THRESH) {
+                memmove(inbuf, data, data_size);
+                data = inbuf;
+                len = fread(data + data_size, 1,
+                            AUDIO_INBUF_SIZE - data_size, f);
+                if (len > 0)
+                    data_size += len;
+            }
         }
+        fclose(f);
     }
 
     /* flush the decoder */
@@ -166,13 +385,25 @@ int main() {
     pkt->size = 0;
     decode(c, pkt, decoded_frame, outfile);
 
+    write_time -= av_gettime_relative();
+    flush_output(outfile);
+    fflush(outfile);
+    write_time += av_gettime_relative();
+    printf("output stage (%s): %"PRId64" bytes in %.3f ms\n",
+           legacy_writer ? "per-sample fwrite" : "packed block", bytes_written, write_time / 1000.0);
+
     fclose(outfile);
-    fclose(f);
+    av_freep(&out_block);
 
     avcodec_free_context(&c);
     av_parser_close(parser);
     av_frame_free(&decoded_frame);
     av_packet_free(&pkt);
 
+    /* the decoder dropped its references to the mapping when it was freed */
+    av_buffer_unref(&map_buf);
+    if (map)
+        av_file_unmap(map, map_size);
+
     return 0;
 }
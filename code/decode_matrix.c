@@ -0,0 +1,260 @@
+/**
+ * @file
+ * Decoding speed of H.264/HEVC elementary streams over CPU feature sets and
+ * thread counts.
+ *
+ * Every input is decoded once per combination of a SIMD level, forced with
+ * av_force_cpu_flags() before the decoder is opened, and a thread count. The
+ * decode loop is the one of decode_video -splitter: the mapped stream is cut
+ * into access units and sent to the decoder without copies, nothing is
+ * written. The fastest of the -repeat runs is kept, and the results go out as
+ * CSV with the speedup over the first thread count (one thread by default)
+ * and over plain C code. SIMD levels the CPU does not have are left out.
+ *
+ * usage: decode_matrix [-threads N,N,...] [-repeat N] [-o file.csv] [input_file...]
+ * @example decode_matrix.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+#include <libavutil/file.h>
+#include <libavutil/time.h>
+
+#include "core/annexb.h"
+
+#define MAX_THREAD_COUNTS 16
+#define DEFAULT_REPEAT 3
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define X86_SSE2 (AV_CPU_FLAG_MMX | AV_CPU_FLAG_MMXEXT | AV_CPU_FLAG_CMOV | \
+                  AV_CPU_FLAG_SSE | AV_CPU_FLAG_SSE2)
+#define X86_AVX2 (X86_SSE2 | AV_CPU_FLAG_SSE3 | AV_CPU_FLAG_SSSE3 | AV_CPU_FLAG_SSE4 | \
+                  AV_CPU_FLAG_SSE42 | AV_CPU_FLAG_AVX | AV_CPU_FLAG_FMA3 | AV_CPU_FLAG_AVX2 | \
+                  AV_CPU_FLAG_BMI1 | AV_CPU_FLAG_BMI2)
+/* the flags that mark slow implementations stay as detected */
+#define X86_SLOW (AV_CPU_FLAG_SSE2SLOW | AV_CPU_FLAG_SSE3SLOW | AV_CPU_FLAG_SSSE3SLOW | \
+                  AV_CPU_FLAG_ATOM | AV_CPU_FLAG_AVXSLOW)
+#endif
+
+/* a SIMD level: the flags it allows, and the one the CPU must have for it */
+typedef struct CpuLevel {
+    const char *name;
+    int flags;
+    int required;
+} CpuLevel;
+
+static const CpuLevel cpu_levels[] = {
+        {"none", 0,        0},
+#ifdef X86_SSE2
+        {"sse2", X86_SSE2, AV_CPU_FLAG_SSE2},
+        {"avx2", X86_AVX2, AV_CPU_FLAG_AVX2},
+#endif
+        {"all",  -1,       0},
+};
+
+#define NB_CPU_LEVELS (sizeof(cpu_levels) / sizeof(cpu_levels[0]))
+
+typedef struct RunResult {
+    int64_t time;           ///< wallclock time from the first packet to the last frame
+    int frames;
+    int active_thread_type;
+} RunResult;
+
+/* decode the whole stream once with the CPU flags already forced */
+static int decode_once(const AVCodec *codec, AVBufferRef *buf, size_t size, int thread_count,
+                       RunResult *res) {
+    AVCodecContext *c = avcodec_alloc_context3(codec);
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    AnnexBSplitter splitter;
+    int64_t start;
+    int ret = AVERROR(ENOMEM), eof = 0;
+
+    if (!c || !pkt || !frame)
+        goto end;
+    c->thread_count = thread_count;
+    c->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    /* the DSP functions are picked from av_get_cpu_flags() here, for every
+     * frame thread too */
+    if ((ret = avcodec_open2(c, codec, NULL)) < 0 ||
+        (ret = annexb_splitter_init(&splitter, codec->id, buf->data, size)) < 0)
+        goto end;
+
+    res->frames = 0;
+    res->active_thread_type = c->active_thread_type;
+    start = av_gettime_relative();
+    while (!eof) {
+        ret = annexb_next_packet(&splitter, buf, pkt);
+        if (ret == AVERROR_EOF)
+            eof = 1;
+        else if (ret < 0)
+            goto end;
+        if ((ret = avcodec_send_packet(c, eof ? NULL : pkt)) < 0)
+            goto end;
+        while ((ret = avcodec_receive_frame(c, frame)) >= 0) {
+            res->frames++;
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            goto end;
+    }
+    res->time = av_gettime_relative() - start;
+    ret = 0;
+
+    end:
+    avcodec_free_context(&c);
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    return ret;
+}
+
+/* the flags to force for a level, within what the CPU has */
+static int level_flags(const CpuLevel *level, int detected) {
+    if (level->flags < 0)
+        return -1;
+#ifdef X86_SLOW
+    if (level->flags)
+        return detected & (level->flags | X86_SLOW);
+#endif
+    return detected & level->flags;
+}
+
+static void mapped_buffer_free(void *opaque, uint8_t *data) {
+    /* the mapping is released with av_file_unmap() after the runs */
+}
+
+static const char *thread_type_name(int thread_type) {
+    return thread_type == FF_THREAD_FRAME ? "frame" : thread_type == FF_THREAD_SLICE ? "slice" : "none";
+}
+
+/* run the matrix for one input and write its rows */
+static int run_matrix(const char *filename, const int *thread_counts, int nb_thread_counts,
+                      int repeat, int detected, FILE *out) {
+    RunResult results[NB_CPU_LEVELS][MAX_THREAD_COUNTS] = {{{0}}}, res;
+    const AVCodec *codec;
+    AVBufferRef *buf = NULL;
+    uint8_t *map;
+    size_t map_size;
+    double fps, base_threads, base_simd;
+    int i, j, k, ret;
+
+    if ((ret = av_file_map(filename, &map, &map_size, 0, NULL)) < 0) {
+        fprintf(stderr, "Could not map %s\n", filename);
+        return ret;
+    }
+    codec = avcodec_find_decoder(annexb_probe(map, map_size));
+    if (!codec) {
+        fprintf(stderr, "%s is neither H.264 nor HEVC\n", filename);
+        ret = AVERROR_DECODER_NOT_FOUND;
+        goto end;
+    }
+    buf = av_buffer_create(map, FFMIN(map_size, INT_MAX), mapped_buffer_free,
+                           NULL, AV_BUFFER_FLAG_READONLY);
+    if (!buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    for (i = 0; i < NB_CPU_LEVELS; i++) {
+        if ((cpu_levels[i].required & detected) != cpu_levels[i].required)
+            continue;
+        av_force_cpu_flags(level_flags(&cpu_levels[i], detected));
+        for (j = 0; j < nb_thread_counts; j++) {
+            for (k = 0; k < repeat; k++) {
+                if ((ret = decode_once(codec, buf, map_size, thread_counts[j], &res)) < 0) {
+                    fprintf(stderr, "Error decoding %s: %s\n", filename, av_err2str(ret));
+                    goto end;
+                }
+                if (!k || res.time < results[i][j].time)
+                    results[i][j] = res;
+            }
+            fprintf(stderr, "%s: %s, %d threads: %.2f fps\n", filename, cpu_levels[i].name,
+                    thread_counts[j], results[i][j].frames * 1000000.0 / FFMAX(results[i][j].time, 1));
+        }
+    }
+
+    for (i = 0; i < NB_CPU_LEVELS; i++) {
+        if ((cpu_levels[i].required & detected) != cpu_levels[i].required)
+            continue;
+        for (j = 0; j < nb_thread_counts; j++) {
+            fps = results[i][j].frames * 1000000.0 / FFMAX(results[i][j].time, 1);
+            base_threads = results[i][0].frames * 1000000.0 / FFMAX(results[i][0].time, 1);
+            base_simd = results[0][j].frames * 1000000.0 / FFMAX(results[0][j].time, 1);
+            fprintf(out, "%s,%s,%s,%d,%s,%d,%.6f,%.2f,%.3f,%.3f\n",
+                    filename, codec->name, cpu_levels[i].name, thread_counts[j],
+                    thread_type_name(results[i][j].active_thread_type), results[i][j].frames,
+                    results[i][j].time / 1000000.0, fps,
+                    base_threads > 0 ? fps / base_threads : 0.0, base_simd > 0 ? fps / base_simd : 0.0);
+        }
+    }
+    fflush(out);
+
+    end:
+    /* back to the detected flags for the next input */
+    av_force_cpu_flags(-1);
+    av_buffer_unref(&buf);
+    av_file_unmap(map, map_size);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    static const char *default_inputs[] = {"../ds.264", "../ds.hevc"};
+    const char **inputs = default_inputs, *out_filename = NULL;
+    int thread_counts[MAX_THREAD_COUNTS], nb_thread_counts = 0;
+    int nb_inputs = 2, repeat = DEFAULT_REPEAT, detected, n, i, ret = 0;
+    FILE *out = stdout;
+    char *p;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            for (p = strtok(argv[++i], ","); p && nb_thread_counts < MAX_THREAD_COUNTS;
+                 p = strtok(NULL, ","))
+                thread_counts[nb_thread_counts++] = FFMAX(atoi(p), 1);
+        } else if (!strcmp(argv[i], "-repeat") && i + 1 < argc) {
+            repeat = FFMAX(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out_filename = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-threads N,N,...] [-repeat N] [-o file.csv] [input_file...]\n"
+                            "Decode every H.264/HEVC input (default ../ds.264 ../ds.hevc) with no\n"
+                            "SIMD, SSE2, AVX2 and all CPU features, and each thread count (default\n"
+                            "1, 2, 4, ... up to the number of cores), keep the fastest of N runs\n"
+                            "(default %d) and write the results as CSV.\n", argv[0], DEFAULT_REPEAT);
+            return 1;
+        } else {
+            inputs = (const char **) argv + i;
+            nb_inputs = argc - i;
+            break;
+        }
+    }
+    if (!nb_thread_counts) {
+        n = av_cpu_count();
+        for (i = 1; i < n && nb_thread_counts < MAX_THREAD_COUNTS - 1; i *= 2)
+            thread_counts[nb_thread_counts++] = i;
+        thread_counts[nb_thread_counts++] = n;
+    }
+    if (out_filename) {
+        out = fopen(out_filename, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open %s\n", out_filename);
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    detected = av_get_cpu_flags();
+    fprintf(out, "file,codec,cpu_flags,threads,thread_type,frames,seconds,fps,"
+                 "thread_speedup,simd_speedup\n");
+    for (i = 0; i < nb_inputs; i++)
+        if (run_matrix(inputs[i], thread_counts, nb_thread_counts, repeat, detected, out) < 0)
+            ret = 1;
+
+    if (out != stdout)
+        fclose(out);
+    return ret;
+}
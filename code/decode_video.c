@@ -27,39 +27,111 @@
  * @example decode_video.c
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+#include <libavutil/file.h>
+#include <libavutil/time.h>
+
+#include "core/annexb.h"
+#include "core/es_index.h"
+#include "core/stage_timer.h"
 
 #define INBUF_SIZE 4096
 
+/* with -mmap only the last MMAP_TAIL_SIZE bytes of the file are copied into a
+ * padded buffer, everything before them is parsed in place: packets returned
+ * from the mapping always have at least this many readable bytes after them,
+ * which covers the decoder overread of AV_INPUT_BUFFER_PADDING_SIZE */
+#define MMAP_TAIL_SIZE INBUF_SIZE
+
+/* most parameter sets fed to the decoder before a -seek start point */
+#define MAX_SEEK_PARAM_SETS 64
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#endif
+
+/* throughput/latency counters for the end-of-run summary; the wallclock time
+ * at which a packet is submitted travels to its frame through pkt->pts, so
+ * the latency figures include the reordering and frame threading delay */
+typedef struct DecodeStats {
+    int64_t start_time;
+    int64_t end_time;
+    int64_t total_latency;
+    int64_t max_latency;
+    int64_t nb_bytes;
+    int nb_packets;
+    int nb_frames;
+} DecodeStats;
+
+/* what one decoding run does, -compare runs it twice with different settings */
+typedef struct DecodeConfig {
+    const char *filename;
+    const char *outfilename;
+    const AVCodec *codec;
+    int thread_count;
+    int thread_type;
+    int use_mmap;
+    int use_splitter;       ///< split the mapping into access units instead of parsing it
+    int keyframes_only;
+    int hevc_tools;         ///< ANNEXB_HEVC_* flags of the first PPS of an HEVC input
+    int64_t seek_frame;     ///< picture to start at with -seek, -1 from the start
+} DecodeConfig;
+
+static int save_frames = 1;
+/* with -stride N only every Nth decoded picture is written */
+static int save_stride = 1;
+/* pictures not written after the -seek keyframe: the distance from the
+ * keyframe to the target in decoding order, counted off the decoder output,
+ * which is in presentation order */
+static int64_t skip_frames;
+
 static void pgm_save(unsigned char *buf, int wrap, int xsize, int ysize,
                      char *filename) {
     FILE *f;
     int i;
 
-    f = fopen(filename, "w");
+    f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(1);
+    }
     fprintf(f, "P5\n%d %d\n%d\n", xsize, ysize, 255);
-    for (i = 0; i < ysize; i++)
-        fwrite(buf + i * wrap, 1, xsize, f);
+    /* a picture without padding goes out in one write */
+    if (wrap == xsize) {
+        fwrite(buf, 1, (size_t) xsize * ysize, f);
+    } else {
+        for (i = 0; i < ysize; i++)
+            fwrite(buf + i * wrap, 1, xsize, f);
+    }
     fclose(f);
 }
 
 static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
-                   const char *filename) {
+                   const char *filename, DecodeStats *stats) {
     char buf[1024];
+    int64_t latency;
     int ret;
 
-    ret = avcodec_send_packet(dec_ctx, pkt);
+    if (pkt) {
+        pkt->pts = av_gettime_relative();
+        stats->nb_bytes += pkt->size;
+        stats->nb_packets++;
+    }
+
+    ret = timed_send_packet(dec_ctx, pkt);
     if (ret < 0) {
         fprintf(stderr, "Error sending a packet for decoding\n");
         exit(1);
     }
 
     while (ret >= 0) {
-        ret = avcodec_receive_frame(dec_ctx, frame);
+        ret = timed_receive_frame(dec_ctx, frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return;
         else if (ret < 0) {
@@ -67,6 +139,17 @@ static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
             exit(1);
         }
 
+        if (frame->pts != AV_NOPTS_VALUE) {
+            latency = av_gettime_relative() - frame->pts;
+            stats->total_latency += latency;
+            stats->max_latency = FFMAX(stats->max_latency, latency);
+        }
+        stats->nb_frames++;
+
+        if (!save_frames || stats->nb_frames <= skip_frames ||
+            (stats->nb_frames - 1 - skip_frames) % save_stride)
+            continue;
+
         printf("saving frame %3d\n", dec_ctx->frame_number);
         fflush(stdout);
 
@@ -78,21 +161,222 @@ static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
     }
 }
 
-int main() {
-    const char *filename, *outfilename;
-    const AVCodec *codec;
+/*
+ * split data into packets with the parser and decode them; data_size 0 flushes
+ * the parser. When src_buf is set, data belongs to it and the packets the
+ * parser returns in place are handed to the decoder as references to src_buf
+ * instead of being copied by avcodec_send_packet()
+ */
+static void parse_and_decode(AVCodecParserContext *parser, AVCodecContext *c,
+                             AVFrame *frame, AVPacket *pkt, AVBufferRef *src_buf,
+                             const uint8_t *data, size_t data_size,
+                             const char *outfilename, DecodeStats *stats) {
+    const uint8_t *data_end = data + data_size;
+    int ret;
+
+    do {
+        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+                               data, FFMIN(data_size, INT_MAX),
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (ret < 0) {
+            fprintf(stderr, "Error while parsing\n");
+            exit(1);
+        }
+        data += ret;
+        data_size -= ret;
+
+        if (pkt->size) {
+            if (src_buf && pkt->data >= src_buf->data && pkt->data + pkt->size <= data_end)
+                pkt->buf = src_buf;
+            decode(c, frame, pkt, outfilename, stats);
+            pkt->buf = NULL;
+        }
+    } while (data_size > 0);
+}
+
+/*
+ * decode the access units of an H.264/HEVC stream in data, which belongs to
+ * src_buf, as packets referencing src_buf; the parameter sets for -seek go
+ * first in a packet of their own
+ */
+static void split_and_decode(AVCodecContext *c, AVFrame *frame, AVPacket *pkt,
+                             AVBufferRef *src_buf, const uint8_t *data, size_t data_size,
+                             uint8_t *ps_data, size_t ps_size,
+                             const char *outfilename, DecodeStats *stats) {
+    AnnexBSplitter splitter;
+    int ret;
+
+    if (annexb_splitter_init(&splitter, c->codec_id, data, data_size) < 0) {
+        fprintf(stderr, "-splitter needs an H.264 or HEVC stream\n");
+        exit(1);
+    }
+    if (ps_size) {
+        pkt->data = ps_data;
+        pkt->size = ps_size;
+        decode(c, frame, pkt, outfilename, stats);
+    }
+    while ((ret = annexb_next_packet(&splitter, src_buf, pkt)) >= 0)
+        decode(c, frame, pkt, outfilename, stats);
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Error while splitting\n");
+        exit(1);
+    }
+}
+
+static void mapped_buffer_free(void *opaque, uint8_t *data) {
+    /* the mapping is released with av_file_unmap() once the decoder is closed */
+}
+
+static int parse_thread_type(const char *name) {
+    if (!strcmp(name, "frame"))
+        return FF_THREAD_FRAME;
+    /* HEVC slice threading is wavefront (WPP) or tile parallel decoding */
+    if (!strcmp(name, "slice") || !strcmp(name, "wpp"))
+        return FF_THREAD_SLICE;
+    if (!strcmp(name, "both"))
+        return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    fprintf(stderr, "Unknown thread type '%s'\n", name);
+    exit(1);
+}
+
+static const char *thread_type_name(int thread_type) {
+    switch (thread_type) {
+        case FF_THREAD_FRAME:
+            return "frame";
+        case FF_THREAD_SLICE:
+            return "slice";
+        case FF_THREAD_FRAME | FF_THREAD_SLICE:
+            return "frame+slice";
+        default:
+            return "none";
+    }
+}
+
+/*
+ * find the keyframe to start decoding at for -seek with the index of the
+ * stream, and read the parameter sets in effect there into a padded buffer
+ * for the parser; returns the offset of the keyframe
+ */
+static int64_t prepare_seek(const DecodeConfig *cfg, uint8_t **ps_data, size_t *ps_size) {
+    const ESParamSet *sets[MAX_SEEK_PARAM_SETS];
+    const ESIndexEntry *entry;
+    ESIndex *idx;
+    int64_t start = av_gettime_relative(), pos;
+    FILE *f;
+    int i, n;
+
+    if (es_index_load(&idx, cfg->filename, cfg->codec->id) < 0) {
+        fprintf(stderr, "Could not index %s, -seek needs an H.264 or HEVC stream\n", cfg->filename);
+        exit(1);
+    }
+    entry = es_index_seek(idx, cfg->seek_frame);
+    if (!entry) {
+        fprintf(stderr, "No keyframe found in %s\n", cfg->filename);
+        exit(1);
+    }
+
+    n = es_index_get_param_sets(idx, entry, sets, MAX_SEEK_PARAM_SETS);
+    *ps_size = 0;
+    for (i = 0; i < n; i++)
+        *ps_size += sets[i]->size;
+    *ps_data = av_mallocz(*ps_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    f = fopen(cfg->filename, "rb");
+    if (!*ps_data || !f) {
+        fprintf(stderr, "Could not read the parameter sets of %s\n", cfg->filename);
+        exit(1);
+    }
+    for (i = 0, *ps_size = 0; i < n; *ps_size += sets[i++]->size) {
+        if (fseeko(f, sets[i]->pos, SEEK_SET) < 0 ||
+            fread(*ps_data + *ps_size, 1, sets[i]->size, f) != (size_t) sets[i]->size) {
+            fprintf(stderr, "Could not read the parameter sets of %s\n", cfg->filename);
+            exit(1);
+        }
+    }
+    fclose(f);
+
+    skip_frames = FFMAX(cfg->seek_frame - entry->frame, 0);
+    pos = entry->pos;
+    printf("seek to picture %"PRId64": keyframe %"PRId64" at offset %"PRId64", "
+           "%d parameter sets, index loaded in %.3f ms\n",
+           cfg->seek_frame, entry->frame, pos, n, (av_gettime_relative() - start) / 1000.0);
+    es_index_free(&idx);
+    return pos;
+}
+
+/*
+ * pick the decoder: the one named by -codec, or the one for the codec the
+ * start of the input looks like; for HEVC also note which of the tools for
+ * parallel decoding the stream uses
+ */
+static void probe_input(DecodeConfig *cfg, const char *codec_name) {
+    uint8_t *buf = av_malloc(ANNEXB_PROBE_SIZE);
+    size_t size = 0;
+    enum AVCodecID codec_id;
+    FILE *f;
+
+    if (!buf)
+        exit(1);
+    f = fopen(cfg->filename, "rb");
+    if (f) {
+        size = fread(buf, 1, ANNEXB_PROBE_SIZE, f);
+        fclose(f);
+    }
+
+    if (codec_name) {
+        cfg->codec = avcodec_find_decoder_by_name(codec_name);
+    } else {
+        codec_id = annexb_probe(buf, size);
+        if (codec_id == AV_CODEC_ID_NONE) {
+            fprintf(stderr, "Could not detect the codec of %s, use -codec\n", cfg->filename);
+            exit(1);
+        }
+        cfg->codec = avcodec_find_decoder(codec_id);
+    }
+    if (!cfg->codec || cfg->codec->type != AVMEDIA_TYPE_VIDEO) {
+        fprintf(stderr, "Codec not found\n");
+        exit(1);
+    }
+
+    if (cfg->codec->id == AV_CODEC_ID_HEVC)
+        cfg->hevc_tools = annexb_hevc_parallel_tools(buf, size);
+    av_free(buf);
+}
+
+static void print_stats(const DecodeConfig *cfg, const AVCodecContext *c, const DecodeStats *stats) {
+    double elapsed = (stats->end_time - stats->start_time) / 1000000.0;
+
+    printf("decoded %d frames from %d packets in %.3f s\n",
+           stats->nb_frames, stats->nb_packets, elapsed);
+    printf("codec: %s %dx%d", cfg->codec->name, c->width, c->height);
+    if (cfg->codec->id == AV_CODEC_ID_HEVC)
+        printf(", WPP %s, tiles %s", cfg->hevc_tools & ANNEXB_HEVC_WPP ? "on" : "off",
+               cfg->hevc_tools & ANNEXB_HEVC_TILES ? "on" : "off");
+    printf("\n");
+    printf("threads: %d (%s), cpus: %d\n",
+           c->thread_count, thread_type_name(c->active_thread_type), av_cpu_count());
+    if (elapsed > 0)
+        printf("throughput: %.2f fps, %.2f Mbit/s\n",
+               stats->nb_frames / elapsed, stats->nb_bytes * 8 / elapsed / 1000000.0);
+    if (stats->nb_frames)
+        printf("latency: avg %.2f ms, max %.2f ms\n",
+               stats->total_latency / 1000.0 / stats->nb_frames,
+               stats->max_latency / 1000.0);
+}
+
+static void run_decode(const DecodeConfig *cfg, DecodeStats *stats) {
     AVCodecParserContext *parser;
     AVCodecContext *c = NULL;
     FILE *f;
     AVFrame *frame;
     uint8_t inbuf[INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
-    uint8_t *data;
     size_t data_size;
-    int ret;
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    AVBufferRef *map_buf = NULL;
     AVPacket *pkt;
-
-    filename = "C:\\Users\\user\\Desktop\\LearnFFmpeg\\ds.264";
-    outfilename = "C:\\Users\\user\\Desktop\\LearnFFmpeg\\decode_video.yuv";
+    uint8_t *ps_data = NULL;
+    size_t ps_size = 0;
+    int64_t start_pos = 0;
 
     pkt = av_packet_alloc();
     if (!pkt)
@@ -101,20 +385,13 @@ int main() {
     /* set end of buffer to 0 (this ensures that no overreading happens for damaged MPEG streams) */
     memset(inbuf + INBUF_SIZE, 0, AV_INPUT_BUFFER_PADDING_SIZE);
 
-    /* find the MPEG-1 video decoder */
-    codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        fprintf(stderr, "Codec not found\n");
-        exit(1);
-    }
-
-    parser = av_parser_init(codec->id);
+    parser = av_parser_init(cfg->codec->id);
     if (!parser) {
         fprintf(stderr, "parser not found\n");
         exit(1);
     }
 
-    c = avcodec_alloc_context3(codec);
+    c = avcodec_alloc_context3(cfg->codec);
     if (!c) {
         fprintf(stderr, "Could not allocate video codec context\n");
         exit(1);
@@ -124,15 +401,33 @@ int main() {
        MUST be initialized there because this information is not
        available in the bitstream. */
 
-    /* open it */
-    if (avcodec_open2(c, codec, NULL) < 0) {
-        fprintf(stderr, "Could not open codec\n");
-        exit(1);
+    /* thread_count 0 lets libavcodec pick one thread per core; frame
+     * threading adds one frame of delay per thread, slice threading only
+     * pays off when the encoder produced several slices per picture */
+    c->thread_count = cfg->thread_count;
+    c->thread_type = cfg->thread_type;
+
+    /* libavcodec runs one kind of threading per decoder and prefers frame
+     * threading. HEVC slice threading only has the CTU rows of WPP or the
+     * tiles to work on, without them it would decode on one thread */
+    if (cfg->codec->id == AV_CODEC_ID_HEVC && cfg->thread_type == FF_THREAD_SLICE &&
+        !cfg->hevc_tools) {
+        fprintf(stderr, "%s uses neither WPP nor tiles, decoding with frame threads\n",
+                cfg->filename);
+        c->thread_type = FF_THREAD_FRAME;
     }
 
-    f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Could not open %s\n", filename);
+    /* keyframe-only decoding: non-key pictures are dropped before their
+     * slices are decoded and the deblocking filter is skipped, which is
+     * good enough for thumbnails */
+    if (cfg->keyframes_only) {
+        c->skip_frame = AVDISCARD_NONKEY;
+        c->skip_loop_filter = AVDISCARD_ALL;
+    }
+
+    /* open it */
+    if (avcodec_open2(c, cfg->codec, NULL) < 0) {
+        fprintf(stderr, "Could not open codec\n");
         exit(1);
     }
 
@@ -142,38 +437,172 @@ int main() {
         exit(1);
     }
 
-    while (!feof(f)) {
-        /* read raw data from the input file */
-        data_size = fread(inbuf, 1, INBUF_SIZE, f);
-        if (!data_size)
-            break;
-
-        /* use the parser to split the data into frames */
-        data = inbuf;
-        while (data_size > 0) {
-            ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
-                                   data, data_size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
-            if (ret < 0) {
-                fprintf(stderr, "Error while parsing\n");
-                exit(1);
-            }
-            data += ret;
-            data_size -= ret;
-
-            if (pkt->size)
-                decode(c, frame, pkt, outfilename);
+    skip_frames = 0;
+    if (cfg->seek_frame >= 0)
+        start_pos = prepare_seek(cfg, &ps_data, &ps_size);
+
+    if (cfg->use_mmap) {
+        if (av_file_map(cfg->filename, &map, &map_size, 0, NULL) < 0) {
+            fprintf(stderr, "Could not map %s\n", cfg->filename);
+            exit(1);
+        }
+        map_buf = av_buffer_create(map, FFMIN(map_size, INT_MAX), mapped_buffer_free,
+                                   NULL, AV_BUFFER_FLAG_READONLY);
+        if (!map_buf) {
+            fprintf(stderr, "Could not allocate buffer reference\n");
+            exit(1);
         }
-    }
 
-    /* flush the decoder */
-    decode(c, frame, NULL, outfilename);
+        stats->start_time = av_gettime_relative();
+        if (cfg->use_splitter) {
+            split_and_decode(c, frame, pkt, map_buf, map + start_pos, map_size - start_pos,
+                             ps_data, ps_size, cfg->outfilename, stats);
+        } else {
+            if (ps_size)
+                parse_and_decode(parser, c, frame, pkt, NULL, ps_data, ps_size,
+                                 cfg->outfilename, stats);
+            data_size = map_size > start_pos + MMAP_TAIL_SIZE ? map_size - MMAP_TAIL_SIZE : start_pos;
+            if (data_size > start_pos)
+                parse_and_decode(parser, c, frame, pkt, map_buf, map + start_pos, data_size - start_pos,
+                                 cfg->outfilename, stats);
 
-    fclose(f);
+            /* the tail goes through the padded buffer like a regular read */
+            memcpy(inbuf, map + data_size, map_size - data_size);
+            memset(inbuf + map_size - data_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+            parse_and_decode(parser, c, frame, pkt, NULL, inbuf, map_size - data_size,
+                             cfg->outfilename, stats);
+        }
+    } else {
+        f = fopen(cfg->filename, "rb");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", cfg->filename);
+            exit(1);
+        }
+
+        stats->start_time = av_gettime_relative();
+        if (ps_size)
+            parse_and_decode(parser, c, frame, pkt, NULL, ps_data, ps_size,
+                             cfg->outfilename, stats);
+        if (start_pos && fseeko(f, start_pos, SEEK_SET) < 0) {
+            fprintf(stderr, "Could not seek in %s\n", cfg->filename);
+            exit(1);
+        }
+        while (!feof(f)) {
+            /* read raw data from the input file */
+            data_size = fread(inbuf, 1, INBUF_SIZE, f);
+            if (!data_size)
+                break;
+
+            /* use the parser to split the data into frames */
+            parse_and_decode(parser, c, frame, pkt, NULL, inbuf, data_size,
+                             cfg->outfilename, stats);
+        }
+        fclose(f);
+    }
+
+    /* flush the parser and the decoder */
+    parse_and_decode(parser, c, frame, pkt, NULL, NULL, 0, cfg->outfilename, stats);
+    decode(c, frame, NULL, cfg->outfilename, stats);
+    stats->end_time = av_gettime_relative();
+    print_stats(cfg, c, stats);
 
     av_parser_close(parser);
     avcodec_free_context(&c);
     av_frame_free(&frame);
     av_packet_free(&pkt);
+    av_free(ps_data);
+
+    /* the decoder dropped its references to the mapping when it was freed */
+    av_buffer_unref(&map_buf);
+    if (map)
+        av_file_unmap(map, map_size);
+}
+
+int main(int argc, char **argv) {
+    DecodeConfig cfg = {0};
+    DecodeStats stats = {0}, full_stats = {0};
+    const char *codec_name = NULL;
+    int i, nb_inputs = 0;
+    int compare = 0;
+
+    cfg.filename = "C:\\Users\\user\\Desktop\\LearnFFmpeg\\ds.264";
+    cfg.outfilename = "C:\\Users\\user\\Desktop\\LearnFFmpeg\\decode_video.yuv";
+    cfg.thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    cfg.seek_frame = -1;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            cfg.thread_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-thread_type") && i + 1 < argc) {
+            cfg.thread_type = parse_thread_type(argv[++i]);
+        } else if (!strcmp(argv[i], "-nosave")) {
+            save_frames = 0;
+        } else if (!strcmp(argv[i], "-mmap")) {
+            cfg.use_mmap = 1;
+        } else if (!strcmp(argv[i], "-splitter")) {
+            cfg.use_mmap = 1;
+            cfg.use_splitter = 1;
+        } else if (!strcmp(argv[i], "-codec") && i + 1 < argc) {
+            codec_name = argv[++i];
+        } else if (!strcmp(argv[i], "-keyframes")) {
+            cfg.keyframes_only = 1;
+        } else if (!strcmp(argv[i], "-stride") && i + 1 < argc) {
+            save_stride = FFMAX(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-compare")) {
+            compare = 1;
+        } else if (!strcmp(argv[i], "-seek") && i + 1 < argc) {
+            cfg.seek_frame = FFMAX(strtoll(argv[++i], NULL, 10), 0);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-threads N] [-thread_type frame|slice|wpp|both] [-nosave] "
+                            "[-mmap] [-splitter] [-codec name] [-keyframes [-compare]] [-stride N] [-seek N] "
+                            "[input_file [output_prefix]]\n"
+                            "-threads 0 (the default) starts one decoding thread per core.\n"
+                            "-thread_type both (the default) uses frame threading; slice threading\n"
+                            "needs several slices per picture, or WPP or tiles with HEVC (wpp).\n"
+                            "-codec selects the decoder, H.264 and HEVC are detected without it.\n"
+                            "-nosave only decodes, without writing the pgm files.\n"
+                            "-mmap maps the input file and parses it in place.\n"
+                            "-splitter maps the input file and cuts it into access units with the\n"
+                            "Annex B start code scanner instead of the parser (H.264/HEVC only).\n"
+                            "-keyframes only decodes the key (IDR/I) pictures, without deblocking.\n"
+                            "-compare decodes the whole file first and reports the keyframe speedup.\n"
+                            "-stride N writes only every Nth decoded picture.\n"
+                            "-seek N starts decoding at the last keyframe K at or before picture N\n"
+                            "(pictures counted in decoding order), skips the first N - K decoded\n"
+                            "pictures (output order) and writes the rest; with B-frames the first\n"
+                            "one written is not necessarily picture N. The keyframe index is kept\n"
+                            "in <input_file>.idx and built on the first use.\n", argv[0]);
+            exit(1);
+        } else if (nb_inputs++ == 0) {
+            cfg.filename = argv[i];
+        } else {
+            cfg.outfilename = argv[i];
+        }
+    }
+
+    probe_input(&cfg, codec_name);
+
+    if (compare && cfg.keyframes_only) {
+        /* reference run: every picture, nothing written, same threading */
+        DecodeConfig full = cfg;
+        int saved = save_frames;
+
+        full.keyframes_only = 0;
+        save_frames = 0;
+        printf("full decode:\n");
+        run_decode(&full, &full_stats);
+        save_frames = saved;
+        printf("keyframe decode:\n");
+    }
+
+    run_decode(&cfg, &stats);
+
+    if (compare && cfg.keyframes_only && stats.end_time > stats.start_time) {
+        printf("keyframes: %d of %d pictures, speedup %.2fx\n",
+               stats.nb_frames, full_stats.nb_frames,
+               (double) (full_stats.end_time - full_stats.start_time) /
+               (stats.end_time - stats.start_time));
+    }
 
     return 0;
 }
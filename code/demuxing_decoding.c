@@ -25,14 +25,42 @@
  * Demuxing and decoding example.
  *
  * Show how to use the libavformat and libavcodec API to demux and
- * decode audio and video data.
+ * decode audio and video data. The demuxer routes the packets of each stream
+ * into its own queue, and the audio and the video decoder run on their own
+ * threads with the send/receive API, so audio decoding never waits behind
+ * the decoding of a video frame.
  * @example demuxing_decoding.c
  */
 
+#include <pthread.h>
+
 #include <libavutil/imgutils.h>
 #include <libavutil/samplefmt.h>
+#include <libavutil/threadmessage.h>
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+
+#include "core/avio_readahead.h"
+#include "core/media_util.h"
+#include "core/stage_timer.h"
+
+/* packets a queue holds before the demuxer blocks on it; audio packets are
+ * small and more frequent, so the audio queue is deeper and the audio decoder
+ * can keep going while the video decoder works through a large frame */
+#define VIDEO_QUEUE_SIZE 16
+#define AUDIO_QUEUE_SIZE 64
+
+/* one decoding thread fed by the demuxer through its packet queue */
+typedef struct StreamDecoder {
+    const char *name;
+    AVCodecContext *dec_ctx;
+    AVThreadMessageQueue *queue;
+    int (*output_frame)(AVFrame *frame);
+    pthread_t thread;
+    int started;
+    int ret;        ///< error the decoder failed with, 0 otherwise
+} StreamDecoder;
 
 static AVFormatContext *fmt_ctx = NULL;
 static AVCodecContext *video_dec_ctx = NULL, *audio_dec_ctx;
@@ -45,156 +73,198 @@ static const char *audio_dst_filename = NULL;
 static FILE *video_dst_file = NULL;
 static FILE *audio_dst_file = NULL;
 
-static uint8_t *video_dst_data[4] = {NULL};
-static int      video_dst_linesize[4];
-static int video_dst_bufsize;
-
 static int video_stream_idx = -1, audio_stream_idx = -1;
-static AVFrame *frame = NULL;
-static AVPacket pkt;
 static int video_frame_count = 0;
 static int audio_frame_count = 0;
 
-/* Enable or disable frame reference counting. You are not supposed to support
- * both paths in your application but pick the one most appropriate to your
- * needs. Look for the use of refcount in this example to see what are the
- * differences of API usage between them. */
-static int refcount = 0;
+static struct SwrContext *swr_ctx;
+static enum AVSampleFormat audio_src_fmt;
+static int audio_src_channels;
+static uint8_t *audio_dst_buf;
+static unsigned int audio_dst_buf_size;
 
-static int decode_packet(int *got_frame, int cached)
+static int output_video_frame(AVFrame *frame)
 {
-    int ret = 0;
-    int decoded = pkt.size;
+    if (frame->width != width || frame->height != height ||
+        frame->format != pix_fmt) {
+        /* To handle this change, one could write the following frames
+         * into another rawvideo file. */
+        fprintf(stderr, "Error: Width, height and pixel format have to be "
+                "constant in a rawvideo file, but the width, height or "
+                "pixel format of the input video changed:\n"
+                "old: width = %d, height = %d, format = %s\n"
+                "new: width = %d, height = %d, format = %s\n",
+                width, height, av_get_pix_fmt_name(pix_fmt),
+                frame->width, frame->height,
+                av_get_pix_fmt_name(frame->format));
+        return AVERROR(EINVAL);
+    }
 
-    *got_frame = 0;
+    printf("video_frame n:%d coded_n:%d\n",
+           video_frame_count++, frame->coded_picture_number);
 
-    if (pkt.stream_index == video_stream_idx) {
-        /* decode video frame */
-        ret = avcodec_decode_video2(video_dec_ctx, frame, got_frame, &pkt);
-        if (ret < 0) {
-            fprintf(stderr, "Error decoding video frame (%s)\n", av_err2str(ret));
+    /* write to rawvideo file: rawvideo expects non aligned data, the rows
+     * are written from the decoder's buffers without the linesize padding */
+    return media_write_video_frame(video_dst_file, frame);
+}
+
+/* planar audio is interleaved into audio_dst_buf, both are set up on the
+ * first planar frame and reused for the following ones */
+static int init_audio_converter(const AVFrame *frame)
+{
+    int64_t layout = frame->channel_layout ? frame->channel_layout :
+                     av_get_default_channel_layout(frame->channels);
+    int ret;
+
+    swr_ctx = swr_alloc_set_opts(NULL,
+                                 layout, av_get_packed_sample_fmt(frame->format), frame->sample_rate,
+                                 layout, frame->format, frame->sample_rate,
+                                 0, NULL);
+    if (!swr_ctx)
+        return AVERROR(ENOMEM);
+    if ((ret = swr_init(swr_ctx)) < 0) {
+        fprintf(stderr, "Could not open the audio converter\n");
+        swr_free(&swr_ctx);
+        return ret;
+    }
+    audio_src_fmt = frame->format;
+    audio_src_channels = frame->channels;
+    return 0;
+}
+
+static int output_audio_frame(AVFrame *frame)
+{
+    int bytes_per_sample = av_get_bytes_per_sample(frame->format) * frame->channels;
+    int ret;
+
+    printf("audio_frame n:%d nb_samples:%d pts:%s\n",
+           audio_frame_count++, frame->nb_samples,
+           av_ts2timestr(frame->pts, &audio_dec_ctx->time_base));
+
+    /* packed audio already has all the channels in the first plane */
+    if (!av_sample_fmt_is_planar(frame->format)) {
+        fwrite(frame->extended_data[0], bytes_per_sample, frame->nb_samples, audio_dst_file);
+        return 0;
+    }
+
+    if (!swr_ctx && (ret = init_audio_converter(frame)) < 0)
+        return ret;
+    if (frame->format != audio_src_fmt || frame->channels != audio_src_channels) {
+        fprintf(stderr, "Error: The sample format and the channel count have to be "
+                "constant in a rawaudio file\n");
+        return AVERROR(EINVAL);
+    }
+
+    /* the sample rate is not changed, so every call converts the whole frame
+     * and nothing is kept back in the converter */
+    av_fast_malloc(&audio_dst_buf, &audio_dst_buf_size, frame->nb_samples * bytes_per_sample);
+    if (!audio_dst_buf)
+        return AVERROR(ENOMEM);
+    ret = swr_convert(swr_ctx, &audio_dst_buf, frame->nb_samples,
+                      (const uint8_t **) frame->extended_data, frame->nb_samples);
+    if (ret < 0) {
+        fprintf(stderr, "Error converting audio samples (%s)\n", av_err2str(ret));
+        return ret;
+    }
+    fwrite(audio_dst_buf, bytes_per_sample, ret, audio_dst_file);
+    return 0;
+}
+
+/* hand every frame the decoder has ready to the output */
+static int receive_frames(StreamDecoder *sd, AVFrame *frame)
+{
+    int ret;
+
+    while ((ret = timed_receive_frame(sd->dec_ctx, frame)) >= 0) {
+        ret = sd->output_frame(frame);
+        av_frame_unref(frame);
+        if (ret < 0)
             return ret;
-        }
+    }
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
 
-        if (*got_frame) {
-
-            if (frame->width != width || frame->height != height ||
-                frame->format != pix_fmt) {
-                /* To handle this change, one could call av_image_alloc again and
-                 * decode the following frames into another rawvideo file. */
-                fprintf(stderr, "Error: Width, height and pixel format have to be "
-                        "constant in a rawvideo file, but the width, height or "
-                        "pixel format of the input video changed:\n"
-                        "old: width = %d, height = %d, format = %s\n"
-                        "new: width = %d, height = %d, format = %s\n",
-                        width, height, av_get_pix_fmt_name(pix_fmt),
-                        frame->width, frame->height,
-                        av_get_pix_fmt_name(frame->format));
-                return -1;
-            }
-
-            printf("video_frame%s n:%d coded_n:%d\n",
-                   cached ? "(cached)" : "",
-                   video_frame_count++, frame->coded_picture_number);
-
-            /* copy decoded frame to destination buffer:
-             * this is required since rawvideo expects non aligned data */
-            av_image_copy(video_dst_data, video_dst_linesize,
-                          (const uint8_t **)(frame->data), frame->linesize,
-                          pix_fmt, width, height);
-
-            /* write to rawvideo file */
-            fwrite(video_dst_data[0], 1, video_dst_bufsize, video_dst_file);
-        }
-    } else if (pkt.stream_index == audio_stream_idx) {
-        /* decode audio frame */
-        ret = avcodec_decode_audio4(audio_dec_ctx, frame, got_frame, &pkt);
+static void *decode_thread(void *arg)
+{
+    StreamDecoder *sd = arg;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt;
+    int ret = AVERROR(ENOMEM);
+
+    while (frame && (ret = av_thread_message_queue_recv(sd->queue, &pkt, 0)) >= 0) {
+        ret = timed_send_packet(sd->dec_ctx, pkt);
+        av_packet_free(&pkt);
         if (ret < 0) {
-            fprintf(stderr, "Error decoding audio frame (%s)\n", av_err2str(ret));
-            return ret;
-        }
-        /* Some audio decoders decode only part of the packet, and have to be
-         * called again with the remainder of the packet data.
-         * Sample: fate-suite/lossless-audio/luckynight-partial.shn
-         * Also, some decoders might over-read the packet. */
-        decoded = FFMIN(ret, pkt.size);
-
-        if (*got_frame) {
-            size_t unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample(frame->format);
-            printf("audio_frame%s n:%d nb_samples:%d pts:%s\n",
-                   cached ? "(cached)" : "",
-                   audio_frame_count++, frame->nb_samples,
-                   av_ts2timestr(frame->pts, &audio_dec_ctx->time_base));
-
-            /* Write the raw audio data samples of the first plane. This works
-             * fine for packed formats (e.g. AV_SAMPLE_FMT_S16). However,
-             * most audio decoders output planar audio, which uses a separate
-             * plane of audio samples for each channel (e.g. AV_SAMPLE_FMT_S16P).
-             * In other words, this code will write only the first audio channel
-             * in these cases.
-             * You should use libswresample or libavfilter to convert the frame
-             * to packed data. */
-            fwrite(frame->extended_data[0], 1, unpadded_linesize, audio_dst_file);
+            fprintf(stderr, "Error submitting a %s packet for decoding (%s)\n",
+                    sd->name, av_err2str(ret));
+            break;
         }
+        if ((ret = receive_frames(sd, frame)) < 0)
+            break;
     }
 
-    /* If we use frame reference counting, we own the data and need
-     * to de-reference it when we don't use it anymore */
-    if (*got_frame && refcount)
-        av_frame_unref(frame);
+    /* the demuxer is done, flush the frames the decoder still holds */
+    if (ret == AVERROR_EOF) {
+        ret = timed_send_packet(sd->dec_ctx, NULL);
+        if (ret >= 0)
+            ret = receive_frames(sd, frame);
+    }
+    if (ret < 0 && ret != AVERROR_EOF) {
+        fprintf(stderr, "Error decoding %s frame (%s)\n", sd->name, av_err2str(ret));
+        sd->ret = ret;
+        /* stop the demuxer if it is blocked on this queue */
+        av_thread_message_queue_set_err_send(sd->queue, AVERROR_EXIT);
+    }
 
-    return decoded;
+    av_frame_free(&frame);
+    return NULL;
+}
+
+static void free_packet_msg(void *msg)
+{
+    av_packet_free((AVPacket **) msg);
+}
+
+static int start_decoder(StreamDecoder *sd, int queue_size)
+{
+    int ret = av_thread_message_queue_alloc(&sd->queue, queue_size, sizeof(AVPacket *));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(sd->queue, free_packet_msg);
+
+    ret = pthread_create(&sd->thread, NULL, decode_thread, sd);
+    if (ret) {
+        fprintf(stderr, "Could not start the %s decoding thread\n", sd->name);
+        return AVERROR(ret);
+    }
+    sd->started = 1;
+    return 0;
+}
+
+/* signal the end of the stream, or AVERROR_EXIT to drop the queued packets,
+ * and wait for the decoder to finish */
+static int stop_decoder(StreamDecoder *sd, int err)
+{
+    if (sd->started) {
+        av_thread_message_queue_set_err_recv(sd->queue, err);
+        pthread_join(sd->thread, NULL);
+    }
+    av_thread_message_queue_free(&sd->queue);
+    return sd->ret;
 }
 
 static int open_codec_context(int *stream_idx,
                               AVCodecContext **dec_ctx, AVFormatContext *fmt_ctx, enum AVMediaType type)
 {
-    int ret, stream_index;
-    AVStream *st;
-    AVCodec *dec = NULL;
-    AVDictionary *opts = NULL;
+    int ret;
 
-    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
+    ret = media_open_stream_decoder(fmt_ctx, type, dec_ctx, NULL);
     if (ret < 0) {
-        fprintf(stderr, "Could not find %s stream in input file '%s'\n",
+        fprintf(stderr, "Could not open %s stream in input file '%s'\n",
                 av_get_media_type_string(type), src_filename);
         return ret;
-    } else {
-        stream_index = ret;
-        st = fmt_ctx->streams[stream_index];
-
-        /* find decoder for the stream */
-        dec = avcodec_find_decoder(st->codecpar->codec_id);
-        if (!dec) {
-            fprintf(stderr, "Failed to find %s codec\n",
-                    av_get_media_type_string(type));
-            return AVERROR(EINVAL);
-        }
-
-        /* Allocate a codec context for the decoder */
-        *dec_ctx = avcodec_alloc_context3(dec);
-        if (!*dec_ctx) {
-            fprintf(stderr, "Failed to allocate the %s codec context\n",
-                    av_get_media_type_string(type));
-            return AVERROR(ENOMEM);
-        }
-
-        /* Copy codec parameters from input stream to output codec context */
-        if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0) {
-            fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
-
-        /* Init the decoders, with or without reference counting */
-        av_dict_set(&opts, "refcounted_frames", refcount ? "1" : "0", 0);
-        if ((ret = avcodec_open2(*dec_ctx, dec, &opts)) < 0) {
-            fprintf(stderr, "Failed to open %s codec\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
-        *stream_idx = stream_index;
     }
+    *stream_idx = ret;
 
     return 0;
 }
@@ -230,30 +300,34 @@ static int get_format_from_sample_fmt(const char **fmt,
 
 int main (int argc, char **argv)
 {
-    int ret = 0, got_frame;
-
-    if (argc != 4 && argc != 5) {
-        fprintf(stderr, "usage: %s [-refcount] input_file video_output_file audio_output_file\n"
+    StreamDecoder video_dec = {.name = "video"}, audio_dec = {.name = "audio"};
+    StreamDecoder *sd;
+    AVPacket *pkt;
+    int ret = 0, err, video_ret, audio_ret, readahead = 0;
+
+    /* -readahead: demux through the prefetching AVIOContext */
+    if (argc == 5 && !strcmp(argv[1], "-readahead")) {
+        readahead = 1;
+        argc--;
+        argv++;
+    }
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s [-readahead] input_file video_output_file audio_output_file\n"
                 "API example program to show how to read frames from an input file.\n"
                 "This program reads frames from a file, decodes them, and writes decoded\n"
                 "video frames to a rawvideo file named video_output_file, and decoded\n"
-                "audio frames to a rawaudio file named audio_output_file.\n\n"
-                "If the -refcount option is specified, the program use the\n"
-                "reference counting frame system which allows keeping a copy of\n"
-                "the data for longer than one decode call.\n"
+                "audio frames to a rawaudio file named audio_output_file.\n"
+                "The audio and the video stream are decoded on separate threads.\n"
+                "-readahead reads the input ahead on a helper thread.\n"
                 "\n", argv[0]);
         exit(1);
     }
-    if (argc == 5 && !strcmp(argv[1], "-refcount")) {
-        refcount = 1;
-        argv++;
-    }
     src_filename = argv[1];
     video_dst_filename = argv[2];
     audio_dst_filename = argv[3];
 
     /* open input file, and allocate format context */
-    if (avformat_open_input(&fmt_ctx, src_filename, NULL, NULL) < 0) {
+    if (avio_readahead_open_input(&fmt_ctx, src_filename, readahead) < 0) {
         fprintf(stderr, "Could not open source file %s\n", src_filename);
         exit(1);
     }
@@ -274,17 +348,9 @@ int main (int argc, char **argv)
             goto end;
         }
 
-        /* allocate image where the decoded image will be put */
         width = video_dec_ctx->width;
         height = video_dec_ctx->height;
         pix_fmt = video_dec_ctx->pix_fmt;
-        ret = av_image_alloc(video_dst_data, video_dst_linesize,
-                             width, height, pix_fmt, 1);
-        if (ret < 0) {
-            fprintf(stderr, "Could not allocate raw video buffer\n");
-            goto end;
-        }
-        video_dst_bufsize = ret;
     }
 
     if (open_codec_context(&audio_stream_idx, &audio_dec_ctx, fmt_ctx, AVMEDIA_TYPE_AUDIO) >= 0) {
@@ -306,42 +372,58 @@ int main (int argc, char **argv)
         goto end;
     }
 
-    frame = av_frame_alloc();
-    if (!frame) {
-        fprintf(stderr, "Could not allocate frame\n");
-        ret = AVERROR(ENOMEM);
-        goto end;
-    }
-
-    /* initialize packet, set data to NULL, let the demuxer fill it */
-    av_init_packet(&pkt);
-    pkt.data = NULL;
-    pkt.size = 0;
-
     if (video_stream)
         printf("Demuxing video from file '%s' into '%s'\n", src_filename, video_dst_filename);
     if (audio_stream)
         printf("Demuxing audio from file '%s' into '%s'\n", src_filename, audio_dst_filename);
 
-    /* read frames from the file */
-    while (av_read_frame(fmt_ctx, &pkt) >= 0) {
-        AVPacket orig_pkt = pkt;
-        do {
-            ret = decode_packet(&got_frame, 0);
-            if (ret < 0)
-                break;
-            pkt.data += ret;
-            pkt.size -= ret;
-        } while (pkt.size > 0);
-        av_packet_unref(&orig_pkt);
+    video_dec.dec_ctx = video_dec_ctx;
+    video_dec.output_frame = output_video_frame;
+    audio_dec.dec_ctx = audio_dec_ctx;
+    audio_dec.output_frame = output_audio_frame;
+    if ((video_stream && (ret = start_decoder(&video_dec, VIDEO_QUEUE_SIZE)) < 0) ||
+        (audio_stream && (ret = start_decoder(&audio_dec, AUDIO_QUEUE_SIZE)) < 0))
+        goto stop;
+
+    /* read packets from the file and route them to the decoding threads */
+    while (1) {
+        pkt = av_packet_alloc();
+        if (!pkt) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        ret = timed_read_frame(fmt_ctx, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+        sd = pkt->stream_index == video_stream_idx ? &video_dec :
+             pkt->stream_index == audio_stream_idx ? &audio_dec : NULL;
+        if (!sd) {
+            av_packet_free(&pkt);
+            continue;
+        }
+        /* fails with AVERROR_EXIT once that decoder gave up */
+        ret = av_thread_message_queue_send(sd->queue, &pkt, 0);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
     }
 
-    /* flush cached frames */
-    pkt.data = NULL;
-    pkt.size = 0;
-    do {
-        decode_packet(&got_frame, 1);
-    } while (got_frame);
+stop:
+    /* at the end of the file the decoders drain what is queued, on an error
+     * the queued packets are dropped */
+    err = ret == AVERROR_EOF ? AVERROR_EOF : AVERROR_EXIT;
+    /* AVERROR_EXIT means a decoder failed, its own error is reported below */
+    if (ret == AVERROR_EOF || ret == AVERROR_EXIT)
+        ret = 0;
+    video_ret = stop_decoder(&video_dec, err);
+    audio_ret = stop_decoder(&audio_dec, err);
+    if (!ret)
+        ret = video_ret < 0 ? video_ret : audio_ret;
+    if (ret < 0)
+        goto end;
 
     printf("Demuxing succeeded.\n");
 
@@ -353,19 +435,11 @@ int main (int argc, char **argv)
     }
 
     if (audio_stream) {
-        enum AVSampleFormat sfmt = audio_dec_ctx->sample_fmt;
+        /* planar audio was interleaved on output */
+        enum AVSampleFormat sfmt = av_get_packed_sample_fmt(audio_dec_ctx->sample_fmt);
         int n_channels = audio_dec_ctx->channels;
         const char *fmt;
 
-        if (av_sample_fmt_is_planar(sfmt)) {
-            const char *packed = av_get_sample_fmt_name(sfmt);
-            printf("Warning: the sample format the decoder produced is planar "
-                   "(%s). This example will output the first channel only.\n",
-                   packed ? packed : "?");
-            sfmt = av_get_packed_sample_fmt(sfmt);
-            n_channels = 1;
-        }
-
         if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
             goto end;
 
@@ -378,13 +452,13 @@ int main (int argc, char **argv)
 end:
     avcodec_free_context(&video_dec_ctx);
     avcodec_free_context(&audio_dec_ctx);
-    avformat_close_input(&fmt_ctx);
+    avio_readahead_close_input(&fmt_ctx);
     if (video_dst_file)
         fclose(video_dst_file);
     if (audio_dst_file)
         fclose(audio_dst_file);
-    av_frame_free(&frame);
-    av_free(video_dst_data[0]);
+    swr_free(&swr_ctx);
+    av_free(audio_dst_buf);
 
     return ret < 0;
 }
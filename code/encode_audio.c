@@ -39,6 +39,13 @@
 #include <libavformat/avformat.h>
 #include <libavutil/samplefmt.h>
 
+#include "core/avio_async_writer.h"
+#include "core/stage_timer.h"
+
+/* the output is written on a helper thread, in buffers of this size */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFERS     2
+
 /* check that a given sample format is supported by the encoder */
 static int check_sample_fmt(const AVCodec *codec, enum AVSampleFormat sample_fmt) {
     const enum AVSampleFormat *p = codec->sample_fmts;
@@ -97,7 +104,6 @@ int main() {
     AVFrame *frame;
     AVPacket *pkt;
     AVStream *av_stream;
-    FILE *f;
 
     const char *in_filename = "../origin.pcm";
     const char *filename = "../encode_aac.aac";
@@ -107,8 +113,8 @@ int main() {
     if (!av_stream) {
         return 1;
     }
-    //Open output URL
-    if (avio_open(&fmt_context->pb, filename, AVIO_FLAG_WRITE) < 0) {
+    //Open output URL, the muxer output is written on a helper thread
+    if (avio_async_writer_open(&fmt_context->pb, filename, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFERS) < 0) {
         printf("Failed to open output file!\n");
         return -1;
     }
@@ -154,13 +160,6 @@ int main() {
         return 1;
     }
 
-
-    f = fopen(filename, "wb");
-    if (!f) {
-        fprintf(stderr, "Could not open %s\n", filename);
-        exit(1);
-    }
-
     /* packet for holding encoded output */
     pkt = av_packet_alloc();
     if (!pkt) {
@@ -198,7 +197,7 @@ int main() {
         pts += frame->nb_samples;
         int ret;
         /* send the frame for encoding */
-        ret = avcodec_send_frame(c, frame);
+        ret = timed_send_frame(c, frame);
         if (ret < 0) {
             fprintf(stderr, "Error sending the frame to the encoder\n");
             exit(1);
@@ -207,7 +206,7 @@ int main() {
         /* read all the available output packets (in general there may be any
          * number of them */
         while (ret >= 0) {
-            ret = avcodec_receive_packet(c, pkt);
+            ret = timed_receive_packet(c, pkt);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                 break;
             else if (ret < 0) {
@@ -215,7 +214,7 @@ int main() {
                 exit(1);
             }
             pkt->stream_index = av_stream->index;
-            av_write_frame(fmt_context, pkt);
+            timed_write_frame(fmt_context, pkt);
             av_packet_unref(pkt);
         }
     }
@@ -223,7 +222,10 @@ int main() {
     av_free(frame_buf);
     av_free(av_stream);
     av_write_trailer(fmt_context);
-    fclose(f);
+    if (avio_async_writer_close(&fmt_context->pb) < 0) {
+        fprintf(stderr, "Error writing %s\n", filename);
+        exit(1);
+    }
     fclose(in_file);
     av_frame_free(&frame);
     av_packet_free(&pkt);
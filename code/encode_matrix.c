@@ -0,0 +1,439 @@
+/**
+ * @file
+ * Speed and quality of libx264/libx265 over presets, tunes and thread counts.
+ *
+ * The first frames of a raw YUV 4:2:0 file are read once and encoded with
+ * every combination of encoder, preset, tune and thread count, at the bitrate
+ * of before_yuv_264 (400 kbit/s, 25 fps). The B-frames are left to the preset
+ * and tune unless -bf forces a count (-bf 3 matches before_yuv_264). Each
+ * encoded stream is decoded again and compared with the source: PSNR over the
+ * luma and over all planes from the summed squared error, and the mean luma
+ * SSIM over 8x8 windows every 4 pixels. One CSV row per run gives the B-frames
+ * actually used, the encoding speed, the bitrate and the quality.
+ *
+ * usage: encode_matrix [-s WxH] [-frames N] [-b bitrate] [-bf N] [-encoders list]
+ *                      [-presets list] [-tunes list] [-threads list] [-o file.csv]
+ *                      [input.yuv]
+ * @example encode_matrix.c
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/avstring.h>
+#include <libavutil/cpu.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+
+#include "core/yuv_frame_source.h"
+
+#define MAX_VALUES 16
+#define FRAME_RATE 25
+/* PSNR of a lossless run */
+#define MAX_PSNR 100.0
+
+/* SSIM constants for 8 bit samples, (0.01 * 255)^2 and (0.03 * 255)^2 */
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+typedef struct EncodeConfig {
+    const char *encoder;
+    const char *preset;
+    const char *tune;       ///< NULL for none
+    int threads;
+    int width;
+    int height;
+    int64_t bit_rate;
+    int max_b_frames;       ///< -1 to keep the B-frames of the preset and tune
+} EncodeConfig;
+
+typedef struct RunResult {
+    int64_t time;           ///< wallclock time from the first frame sent to the last packet
+    int64_t bytes;
+    int nb_packets;
+    int bframes;            ///< longest run of B-frames in the encoded stream
+    int nb_compared;        ///< decoded pictures matched with a source frame
+    double sse[3];
+    double samples[3];
+    double ssim_y;          ///< sum over the compared pictures
+} RunResult;
+
+/* split a comma separated list in place */
+static int split_list(char *list, const char **values) {
+    char *p;
+    int n = 0;
+
+    for (p = strtok(list, ","); p && n < MAX_VALUES; p = strtok(NULL, ","))
+        values[n++] = p;
+    return n;
+}
+
+static AVCodecContext *open_encoder(const EncodeConfig *cfg) {
+    const AVCodec *codec = avcodec_find_encoder_by_name(cfg->encoder);
+    AVCodecContext *c;
+    AVDictionary *opts = NULL;
+    char params[80];
+    int ret;
+
+    if (!codec)
+        return NULL;
+    c = avcodec_alloc_context3(codec);
+    if (!c)
+        return NULL;
+    c->pix_fmt = AV_PIX_FMT_YUV420P;
+    c->width = cfg->width;
+    c->height = cfg->height;
+    c->time_base = (AVRational) {1, FRAME_RATE};
+    c->bit_rate = cfg->bit_rate;
+    /* libx264 applies max_b_frames after the preset and tune, so it is only
+     * set when asked for, otherwise ultrafast and zerolatency would run with
+     * B-frames they do not have */
+    if (cfg->max_b_frames >= 0 && codec->id != AV_CODEC_ID_HEVC)
+        c->max_b_frames = cfg->max_b_frames;
+
+    av_dict_set(&opts, "preset", cfg->preset, 0);
+    if (cfg->tune)
+        av_dict_set(&opts, "tune", cfg->tune, 0);
+    /* libx265 does not look at thread_count, its worker pool is set up
+     * through x265-params like in before_yuv_264 */
+    if (codec->id == AV_CODEC_ID_HEVC) {
+        if (cfg->threads == 1)
+            snprintf(params, sizeof(params), "pools=none:frame-threads=1:log-level=error");
+        else
+            snprintf(params, sizeof(params), "pools=%d:log-level=error", cfg->threads);
+        if (cfg->max_b_frames >= 0)
+            av_strlcatf(params, sizeof(params), ":bframes=%d", cfg->max_b_frames);
+        av_dict_set(&opts, "x265-params", params, 0);
+    } else {
+        c->thread_count = cfg->threads;
+    }
+
+    ret = avcodec_open2(c, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        avcodec_free_context(&c);
+    return c;
+}
+
+static int collect_packets(AVCodecContext *c, AVPacket ***packets, int *nb_packets, RunResult *res) {
+    AVPacket *pkt;
+    int ret;
+
+    while (1) {
+        pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
+        ret = avcodec_receive_packet(c, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+        }
+        res->bytes += pkt->size;
+        if ((ret = av_dynarray_add_nofree(packets, nb_packets, pkt)) < 0) {
+            av_packet_free(&pkt);
+            return ret;
+        }
+    }
+}
+
+/* the longest run of packets whose pts is below that of a packet decoded
+ * before them: the B-frames the encoder actually used */
+static int count_bframes(AVPacket **packets, int nb_packets) {
+    int64_t max_pts = AV_NOPTS_VALUE;
+    int i, run = 0, longest = 0;
+
+    for (i = 0; i < nb_packets; i++) {
+        if (packets[i]->pts == AV_NOPTS_VALUE)
+            continue;
+        if (max_pts != AV_NOPTS_VALUE && packets[i]->pts < max_pts) {
+            longest = FFMAX(longest, ++run);
+        } else {
+            max_pts = packets[i]->pts;
+            run = 0;
+        }
+    }
+    return longest;
+}
+
+/* mean SSIM of the luma plane over 8x8 windows every 4 pixels */
+static double ssim_plane(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                         int width, int height) {
+    double mu1, mu2, var, cov, sum = 0;
+    int64_t s1, s2, ss, s12;
+    int x, y, i, j, n = 0;
+
+    for (y = 0; y + 8 <= height; y += 4) {
+        for (x = 0; x + 8 <= width; x += 4) {
+            s1 = s2 = ss = s12 = 0;
+            for (j = 0; j < 8; j++) {
+                for (i = 0; i < 8; i++) {
+                    int p = a[(y + j) * a_stride + x + i], q = b[(y + j) * b_stride + x + i];
+                    s1 += p;
+                    s2 += q;
+                    ss += p * p + q * q;
+                    s12 += p * q;
+                }
+            }
+            mu1 = s1 / 64.0;
+            mu2 = s2 / 64.0;
+            var = ss / 64.0 - mu1 * mu1 - mu2 * mu2;    /* var1 + var2 */
+            cov = s12 / 64.0 - mu1 * mu2;
+            sum += (2 * mu1 * mu2 + SSIM_C1) * (2 * cov + SSIM_C2) /
+                   ((mu1 * mu1 + mu2 * mu2 + SSIM_C1) * (var + SSIM_C2));
+            n++;
+        }
+    }
+    return n ? sum / n : 1.0;
+}
+
+static void compare_frames(const AVFrame *src, const AVFrame *dec, RunResult *res) {
+    const uint8_t *a, *b;
+    int plane, x, y, w, h, d;
+    int64_t sse;
+
+    for (plane = 0; plane < 3; plane++) {
+        w = plane ? AV_CEIL_RSHIFT(src->width, 1) : src->width;
+        h = plane ? AV_CEIL_RSHIFT(src->height, 1) : src->height;
+        sse = 0;
+        for (y = 0; y < h; y++) {
+            a = src->data[plane] + y * src->linesize[plane];
+            b = dec->data[plane] + y * dec->linesize[plane];
+            for (x = 0; x < w; x++) {
+                d = a[x] - b[x];
+                sse += d * d;
+            }
+        }
+        res->sse[plane] += sse;
+        res->samples[plane] += (double) w * h;
+    }
+    res->ssim_y += ssim_plane(src->data[0], src->linesize[0], dec->data[0], dec->linesize[0],
+                              src->width, src->height);
+    res->nb_compared++;
+}
+
+/* decode the packets and compare every picture with the source frame of its pts */
+static int measure_quality(enum AVCodecID codec_id, AVPacket **packets, int nb_packets,
+                           AVFrame **frames, int nb_frames, RunResult *res) {
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    AVCodecContext *c = NULL;
+    AVFrame *frame = av_frame_alloc();
+    int i, ret = AVERROR(ENOMEM);
+
+    if (!codec || !frame || !(c = avcodec_alloc_context3(codec)))
+        goto end;
+    if ((ret = avcodec_open2(c, codec, NULL)) < 0)
+        goto end;
+
+    for (i = 0; i <= nb_packets; i++) {
+        if ((ret = avcodec_send_packet(c, i < nb_packets ? packets[i] : NULL)) < 0)
+            goto end;
+        while ((ret = avcodec_receive_frame(c, frame)) >= 0) {
+            if (frame->pts >= 0 && frame->pts < nb_frames && frame->format == AV_PIX_FMT_YUV420P &&
+                frame->width == frames[0]->width && frame->height == frames[0]->height)
+                compare_frames(frames[frame->pts], frame, res);
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            goto end;
+    }
+    ret = 0;
+
+    end:
+    avcodec_free_context(&c);
+    av_frame_free(&frame);
+    return ret;
+}
+
+static double psnr(double sse, double samples) {
+    return sse > 0 ? FFMIN(10 * log10(255.0 * 255.0 * samples / sse), MAX_PSNR) : MAX_PSNR;
+}
+
+/* encode the frames with one configuration and write its row */
+static int run_config(const EncodeConfig *cfg, AVFrame **frames, int nb_frames, FILE *out) {
+    AVCodecContext *c = open_encoder(cfg);
+    AVPacket **packets = NULL;
+    RunResult res = {0};
+    enum AVCodecID codec_id;
+    double seconds, duration;
+    int i, ret;
+
+    if (!c) {
+        fprintf(stderr, "Could not open %s with preset %s tune %s, skipped\n",
+                cfg->encoder, cfg->preset, cfg->tune ? cfg->tune : "none");
+        return 0;
+    }
+    codec_id = c->codec_id;
+
+    res.time = av_gettime_relative();
+    for (i = 0; i <= nb_frames; i++) {
+        if ((ret = avcodec_send_frame(c, i < nb_frames ? frames[i] : NULL)) < 0 ||
+            (ret = collect_packets(c, &packets, &res.nb_packets, &res)) < 0)
+            goto end;
+    }
+    res.time = av_gettime_relative() - res.time;
+    res.bframes = count_bframes(packets, res.nb_packets);
+    avcodec_free_context(&c);
+
+    if ((ret = measure_quality(codec_id, packets, res.nb_packets, frames, nb_frames, &res)) < 0)
+        goto end;
+    if (res.nb_compared != nb_frames)
+        fprintf(stderr, "%s: only %d of %d pictures decoded\n", cfg->encoder, res.nb_compared, nb_frames);
+
+    seconds = res.time / 1000000.0;
+    duration = (double) nb_frames / FRAME_RATE;
+    fprintf(out, "%s,%s,%s,%d,%d,%d,%.6f,%.2f,%.1f,%.3f,%.3f,%.5f\n",
+            cfg->encoder, cfg->preset, cfg->tune ? cfg->tune : "none", cfg->threads, res.bframes,
+            nb_frames, seconds, seconds > 0 ? nb_frames / seconds : 0.0, res.bytes * 8 / duration / 1000,
+            psnr(res.sse[0], res.samples[0]),
+            psnr(res.sse[0] + res.sse[1] + res.sse[2], res.samples[0] + res.samples[1] + res.samples[2]),
+            res.nb_compared ? res.ssim_y / res.nb_compared : 0.0);
+    fflush(out);
+    fprintf(stderr, "%s %s %s, %d threads: %.2f fps\n", cfg->encoder, cfg->preset,
+            cfg->tune ? cfg->tune : "none", cfg->threads, seconds > 0 ? nb_frames / seconds : 0.0);
+
+    end:
+    if (ret < 0)
+        fprintf(stderr, "Error encoding with %s: %s\n", cfg->encoder, av_err2str(ret));
+    avcodec_free_context(&c);
+    for (i = 0; i < res.nb_packets; i++)
+        av_packet_free(&packets[i]);
+    av_free(packets);
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-s WxH] [-frames N] [-b bitrate] [-bf N] [-encoders list]\n"
+                    "       [-presets list] [-tunes list] [-threads list] [-o file.csv] [input.yuv]\n"
+                    "Encode the first N frames (default 100) of a raw YUV 4:2:0 file (default\n"
+                    "../ds_480x272.yuv, 480x272) with every combination of the comma separated\n"
+                    "encoders (default libx264,libx265), presets (ultrafast,veryfast,medium,\n"
+                    "slow), tunes (none,zerolatency) and thread counts (1 and the number of\n"
+                    "cores), and write fps, bitrate, PSNR and SSIM against the source as CSV.\n"
+                    "-bf N forces N B-frames (3 like before_yuv_264), by default the preset\n"
+                    "and tune decide; the bframes column gives the count actually used.\n", name);
+}
+
+int main(int argc, char **argv) {
+    const char *in_file = "../ds_480x272.yuv";
+    const char *out_filename = NULL;
+    const char *encoders[MAX_VALUES] = {"libx264", "libx265"};
+    const char *presets[MAX_VALUES] = {"ultrafast", "veryfast", "medium", "slow"};
+    const char *tunes[MAX_VALUES] = {"none", "zerolatency"};
+    const char *thread_lists[MAX_VALUES];
+    int nb_encoders = 2, nb_presets = 4, nb_tunes = 2, nb_threads = 0;
+    int threads[MAX_VALUES];
+    EncodeConfig cfg = {0};
+    YUVFrameSource *src;
+    AVFrame **frames = NULL;
+    FILE *out = stdout;
+    int max_frames = 100, nb_frames = 0, i, e, p, t, n, ret = 0;
+
+    cfg.width = 480;
+    cfg.height = 272;
+    cfg.bit_rate = 400000;
+    cfg.max_b_frames = -1;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &cfg.width, &cfg.height) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+            max_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            cfg.bit_rate = strtoll(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-bf") && i + 1 < argc) {
+            cfg.max_b_frames = atoi(argv[++i]);
+            if (cfg.max_b_frames < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-encoders") && i + 1 < argc) {
+            nb_encoders = split_list(argv[++i], encoders);
+        } else if (!strcmp(argv[i], "-presets") && i + 1 < argc) {
+            nb_presets = split_list(argv[++i], presets);
+        } else if (!strcmp(argv[i], "-tunes") && i + 1 < argc) {
+            nb_tunes = split_list(argv[++i], tunes);
+        } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            n = split_list(argv[++i], thread_lists);
+            for (nb_threads = 0; nb_threads < n; nb_threads++)
+                threads[nb_threads] = FFMAX(atoi(thread_lists[nb_threads]), 1);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out_filename = argv[++i];
+        } else if (argv[i][0] != '-') {
+            in_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (max_frames <= 0 || cfg.width <= 0 || cfg.height <= 0 || cfg.bit_rate <= 0 ||
+        !nb_encoders || !nb_presets || !nb_tunes) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!nb_threads) {
+        threads[nb_threads++] = 1;
+        if (av_cpu_count() > 1)
+            threads[nb_threads++] = av_cpu_count();
+    }
+
+    /* the source frames stay in memory, every run encodes the same pictures */
+    src = yuv_frame_source_open(in_file, AV_PIX_FMT_YUV420P, cfg.width, cfg.height, 64);
+    if (!src) {
+        fprintf(stderr, "Could not open %s\n", in_file);
+        return 1;
+    }
+    while (nb_frames < max_frames) {
+        AVFrame *frame = av_frame_alloc();
+
+        if (!frame || yuv_frame_source_read(src, frame) < 0) {
+            av_frame_free(&frame);
+            break;
+        }
+        frame->pts = nb_frames;
+        if (av_dynarray_add_nofree(&frames, &nb_frames, frame) < 0) {
+            av_frame_free(&frame);
+            break;
+        }
+    }
+    yuv_frame_source_close(&src);
+    if (!nb_frames) {
+        fprintf(stderr, "No complete %dx%d frame in %s\n", cfg.width, cfg.height, in_file);
+        return 1;
+    }
+
+    if (out_filename) {
+        out = fopen(out_filename, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open %s\n", out_filename);
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    fprintf(out, "encoder,preset,tune,threads,bframes,frames,seconds,fps,kbps,psnr_y,psnr_yuv,ssim_y\n");
+    for (e = 0; e < nb_encoders && ret >= 0; e++) {
+        for (p = 0; p < nb_presets && ret >= 0; p++) {
+            for (t = 0; t < nb_tunes && ret >= 0; t++) {
+                for (i = 0; i < nb_threads && ret >= 0; i++) {
+                    cfg.encoder = encoders[e];
+                    cfg.preset = presets[p];
+                    cfg.tune = strcmp(tunes[t], "none") ? tunes[t] : NULL;
+                    cfg.threads = threads[i];
+                    ret = run_config(&cfg, frames, nb_frames, out);
+                }
+            }
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    for (i = 0; i < nb_frames; i++)
+        av_frame_free(&frames[i]);
+    av_free(frames);
+    return ret < 0;
+}
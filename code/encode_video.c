@@ -36,6 +36,10 @@
 #include <libavutil/opt.h>
 #include <libavutil/imgutils.h>
 
+#include "core/media_util.h"
+#include "core/yuv_frame_source.h"
+#include "core/stage_timer.h"
+
 static void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
                    FILE *outfile) {
     int ret;
@@ -44,14 +48,14 @@ static void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
     if (frame)
         printf("Send frame %3"PRId64"\n", frame->pts);
 
-    ret = avcodec_send_frame(enc_ctx, frame);
+    ret = timed_send_frame(enc_ctx, frame);
     if (ret < 0) {
         fprintf(stderr, "Error sending a frame for encoding\n");
         exit(1);
     }
 
     while (ret >= 0) {
-        ret = avcodec_receive_packet(enc_ctx, pkt);
+        ret = timed_receive_packet(enc_ctx, pkt);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return;
         else if (ret < 0) {
@@ -76,6 +80,7 @@ int main() {
     FILE *f;
     AVFrame *frame;
     AVPacket *pkt;
+    YUVFrameSource *yuv_src;
     /* find the mpeg1video encoder */
     codec = avcodec_find_encoder(AV_CODEC_ID_H264);
     if (!codec) {
@@ -115,63 +120,38 @@ int main() {
         av_opt_set(c->priv_data, "preset", "slow", 0);
 
     /* open it */
-    ret = avcodec_open2(c, codec, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "Could not open codec: %s\n", av_err2str(ret));
-        exit(1);
-    }
+    media_check(avcodec_open2(c, codec, NULL), "Could not open codec");
 
-    f = fopen(filename, "wb");
-    if (!f) {
-        fprintf(stderr, "Could not open %s\n", filename);
-        exit(1);
-    }
+    f = media_fopen(filename, "wb");
 
     frame = av_frame_alloc();
     if (!frame) {
         fprintf(stderr, "Could not allocate video frame\n");
         exit(1);
     }
-    frame->format = c->pix_fmt;
-    frame->width = c->width;
-    frame->height = c->height;
 
-    ret = av_frame_get_buffer(frame, 32);
-    if (ret < 0) {
-        fprintf(stderr, "Could not allocate the video frame data\n");
+    /* every picture is read into its own pooled buffer, the encoder may keep
+     * a reference to it for its lookahead while the next one is read */
+    yuv_src = yuv_frame_source_open(yuv_filename, c->pix_fmt, c->width, c->height, 32);
+    if (!yuv_src) {
+        fprintf(stderr, "Could not open %s\n", yuv_filename);
         exit(1);
     }
-
-    FILE *yuv_file = fopen(yuv_filename, "rb");
-    int picture_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, c->width, c->height, 1);
-    uint8_t *picture_buf = (uint8_t *) av_malloc(picture_size);
-    //像素缓冲区
-    av_image_fill_arrays(frame->data, frame->linesize, picture_buf, c->pix_fmt, c->width,
-                         c->height, 1);
-    int y_size = c->width * c->height;
     int pts = 0;
-    /* encode 1 second of video */
-    while (!feof(yuv_file)) {
-        /* make sure the frame data is writable */
-        ret = av_frame_make_writable(frame);
-        if (ret < 0)
-            exit(1);
-        if (fread(picture_buf, 1, y_size * 3 / 2, yuv_file) < 0) {
-            printf("Failed to read raw data! \n");
-            return -1;
-        }
-        frame->data[0] = picture_buf;              // Y
-        frame->data[1] = picture_buf + y_size;      // U
-        frame->data[2] = picture_buf + y_size * 5 / 4;  // V
+    while ((ret = yuv_frame_source_read(yuv_src, frame)) >= 0) {
         frame->pts = pts;
         pts++;
         /* encode the image */
         encode(c, frame, pkt, f);
+        av_frame_unref(frame);
     }
+    if (ret != AVERROR_EOF)
+        media_check(ret, "Failed to read raw data");
 
     /* flush the encoder */
     encode(c, NULL, pkt, f);
     fclose(f);
+    yuv_frame_source_close(&yuv_src);
     avcodec_free_context(&c);
     av_frame_free(&frame);
     av_packet_free(&pkt);
@@ -0,0 +1,434 @@
+/**
+ * @file
+ * Threaded decoding and filtering pipeline.
+ *
+ * Same processing as filtering_video.c, but demuxing, decoding, filtering and
+ * writing the raw output each run on their own thread. The stages exchange
+ * refcounted AVPacket/AVFrame pointers through bounded AVThreadMessageQueues,
+ * so they overlap and the wall time approaches the one of the slowest stage
+ * instead of the sum of all of them.
+ * @example filtering_pipeline.c
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/opt.h>
+#include <libavutil/threadmessage.h>
+#include <libavutil/time.h>
+
+#include "core/media_util.h"
+#include "core/stage_timer.h"
+
+/* number of packets/frames each queue holds before the producer blocks */
+#define QUEUE_SIZE 8
+
+typedef struct Stage {
+    const char *name;
+    void *(*run)(void *);
+    pthread_t thread;
+    int64_t busy;   ///< time spent outside of the queues
+    int count;      ///< packets or frames produced
+    int ret;        ///< error the stage failed with, 0 otherwise
+} Stage;
+
+static AVFormatContext *fmt_ctx;
+static AVCodecContext *dec_ctx;
+static AVFilterContext *buffersink_ctx;
+static AVFilterContext *buffersrc_ctx;
+static AVFilterGraph *filter_graph;
+static int video_stream_index = -1;
+static FILE *out_file;
+
+static AVThreadMessageQueue *packet_queue;
+static AVThreadMessageQueue *frame_queue;
+static AVThreadMessageQueue *filtered_queue;
+
+static void free_packet_msg(void *msg) {
+    av_packet_free((AVPacket **) msg);
+}
+
+static void free_frame_msg(void *msg) {
+    av_frame_free((AVFrame **) msg);
+}
+
+static int open_input_file(const char *filename) {
+    int ret;
+
+    if ((ret = avformat_open_input(&fmt_ctx, filename, NULL, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
+        return ret;
+    }
+
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
+        return ret;
+    }
+
+    /* select the video stream and init its decoder */
+    ret = media_open_stream_decoder(fmt_ctx, AVMEDIA_TYPE_VIDEO, &dec_ctx, NULL);
+    if (ret < 0)
+        return ret;
+    video_stream_index = ret;
+
+    return 0;
+}
+
+static int init_filters(const char *filters_descr) {
+    char args[512];
+    int ret = 0;
+    const AVFilter *buffersrc = avfilter_get_by_name("buffer");
+    const AVFilter *buffersink = avfilter_get_by_name("buffersink");
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs = avfilter_inout_alloc();
+    AVRational time_base = fmt_ctx->streams[video_stream_index]->time_base;
+    enum AVPixelFormat pix_fmts[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE};
+
+    filter_graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !filter_graph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* buffer video source: the decoded frames from the decoder will be inserted here. */
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             dec_ctx->width, dec_ctx->height, dec_ctx->pix_fmt,
+             time_base.num, time_base.den,
+             dec_ctx->sample_aspect_ratio.num, dec_ctx->sample_aspect_ratio.den);
+
+    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in",
+                                       args, NULL, filter_graph);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot create buffer source\n");
+        goto end;
+    }
+
+    /* buffer video sink: to terminate the filter chain. */
+    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
+                                       NULL, NULL, filter_graph);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
+        goto end;
+    }
+
+    ret = av_opt_set_int_list(buffersink_ctx, "pix_fmts", pix_fmts,
+                              AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot set output pixel format\n");
+        goto end;
+    }
+
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = buffersrc_ctx;
+    outputs->pad_idx = 0;
+    outputs->next = NULL;
+
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = buffersink_ctx;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+
+    if ((ret = avfilter_graph_parse_ptr(filter_graph, filters_descr,
+                                        &inputs, &outputs, NULL)) < 0)
+        goto end;
+
+    if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
+        goto end;
+
+    end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    return ret;
+}
+
+/*
+ * Each stage reads from its input queue until it returns AVERROR_EOF and then
+ * signals AVERROR_EOF to its consumer. A stage that fails, or whose consumer
+ * went away, sets AVERROR_EXIT on both of its queues, which stops the producer
+ * blocked in av_thread_message_queue_send(). The consumer would still receive
+ * the queued messages before AVERROR_EXIT, so they are flushed first and it
+ * stops at its next receive.
+ */
+static void finish_stage(Stage *st, AVThreadMessageQueue *in, AVThreadMessageQueue *out, int ret) {
+    int done = ret >= 0 || ret == AVERROR_EOF;
+
+    if (!done && ret != AVERROR_EXIT) {
+        av_log(NULL, AV_LOG_ERROR, "%s stage failed: %s\n", st->name, av_err2str(ret));
+        st->ret = ret;
+    }
+    if (in)
+        av_thread_message_queue_set_err_send(in, AVERROR_EXIT);
+    if (out) {
+        av_thread_message_queue_set_err_recv(out, done ? AVERROR_EOF : AVERROR_EXIT);
+        if (!done)
+            av_thread_message_flush(out);
+    }
+}
+
+/* send a message downstream without accounting the time blocked as busy */
+static int send_msg(Stage *st, AVThreadMessageQueue *queue, void *msg) {
+    int ret;
+
+    st->busy += av_gettime_relative();
+    ret = av_thread_message_queue_send(queue, msg, 0);
+    st->busy -= av_gettime_relative();
+    return ret;
+}
+
+static void *demux_thread(void *arg) {
+    Stage *st = arg;
+    AVPacket *pkt;
+    int ret = 0;
+
+    st->busy -= av_gettime_relative();
+    while (1) {
+        pkt = av_packet_alloc();
+        if (!pkt) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        ret = timed_read_frame(fmt_ctx, pkt);
+        if (ret < 0 || pkt->stream_index != video_stream_index) {
+            av_packet_free(&pkt);
+            if (ret < 0)
+                break;
+            continue;
+        }
+        st->count++;
+
+        ret = send_msg(st, packet_queue, &pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+    }
+    st->busy += av_gettime_relative();
+
+    finish_stage(st, NULL, packet_queue, ret);
+    return NULL;
+}
+
+/* move every frame the decoder has ready to the filter queue */
+static int receive_frames(Stage *st) {
+    AVFrame *frame;
+    int ret;
+
+    while (1) {
+        frame = av_frame_alloc();
+        if (!frame)
+            return AVERROR(ENOMEM);
+        ret = timed_receive_frame(dec_ctx, frame);
+        if (ret < 0) {
+            av_frame_free(&frame);
+            return ret == AVERROR(EAGAIN) ? 0 : ret;
+        }
+        frame->pts = frame->best_effort_timestamp;
+        st->count++;
+
+        ret = send_msg(st, frame_queue, &frame);
+        if (ret < 0) {
+            av_frame_free(&frame);
+            return ret;
+        }
+    }
+}
+
+static void *decode_thread(void *arg) {
+    Stage *st = arg;
+    AVPacket *pkt;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(packet_queue, &pkt, 0)) >= 0) {
+        st->busy -= av_gettime_relative();
+        ret = timed_send_packet(dec_ctx, pkt);
+        av_packet_free(&pkt);
+        if (ret >= 0)
+            ret = receive_frames(st);
+        st->busy += av_gettime_relative();
+        if (ret < 0)
+            break;
+    }
+
+    if (ret == AVERROR_EOF) {
+        /* the demuxer is done, drain the frames the decoder still holds */
+        st->busy -= av_gettime_relative();
+        ret = timed_send_packet(dec_ctx, NULL);
+        if (ret >= 0)
+            ret = receive_frames(st);
+        st->busy += av_gettime_relative();
+    }
+
+    finish_stage(st, packet_queue, frame_queue, ret);
+    return NULL;
+}
+
+/* move every frame the filtergraph has ready to the output queue */
+static int pull_filtered_frames(Stage *st) {
+    AVFrame *filt_frame;
+    int ret;
+
+    while (1) {
+        filt_frame = av_frame_alloc();
+        if (!filt_frame)
+            return AVERROR(ENOMEM);
+        ret = timed_buffersink_get_frame(buffersink_ctx, filt_frame);
+        if (ret < 0) {
+            av_frame_free(&filt_frame);
+            return ret == AVERROR(EAGAIN) ? 0 : ret;
+        }
+        st->count++;
+
+        ret = send_msg(st, filtered_queue, &filt_frame);
+        if (ret < 0) {
+            av_frame_free(&filt_frame);
+            return ret;
+        }
+    }
+}
+
+static void *filter_thread(void *arg) {
+    Stage *st = arg;
+    AVFrame *frame;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(frame_queue, &frame, 0)) >= 0) {
+        st->busy -= av_gettime_relative();
+        /* the filtergraph takes over the frame reference */
+        ret = timed_buffersrc_add_frame_flags(buffersrc_ctx, frame, 0);
+        av_frame_free(&frame);
+        if (ret >= 0)
+            ret = pull_filtered_frames(st);
+        st->busy += av_gettime_relative();
+        if (ret < 0)
+            break;
+    }
+
+    if (ret == AVERROR_EOF) {
+        st->busy -= av_gettime_relative();
+        ret = timed_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0);
+        if (ret >= 0)
+            ret = pull_filtered_frames(st);
+        st->busy += av_gettime_relative();
+    }
+
+    finish_stage(st, frame_queue, filtered_queue, ret);
+    return NULL;
+}
+
+static void *output_thread(void *arg) {
+    Stage *st = arg;
+    AVFrame *frame;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(filtered_queue, &frame, 0)) >= 0) {
+        st->busy -= av_gettime_relative();
+        ret = media_write_video_frame(out_file, frame);
+        av_frame_free(&frame);
+        st->busy += av_gettime_relative();
+        if (ret < 0)
+            break;
+        st->count++;
+    }
+
+    finish_stage(st, filtered_queue, NULL, ret);
+    return NULL;
+}
+
+static int alloc_queue(AVThreadMessageQueue **queue, void (*free_func)(void *msg)) {
+    int ret = av_thread_message_queue_alloc(queue, QUEUE_SIZE, sizeof(void *));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(*queue, free_func);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Stage stages[] = {
+            {"demux",  demux_thread},
+            {"decode", decode_thread},
+            {"filter", filter_thread},
+            {"output", output_thread},
+    };
+    const char *in_filename = "../ds.264";
+    const char *out_filename = "../filtering_pipeline.yuv";
+    const char *filter_descr = "hflip";
+    int64_t start, elapsed;
+    int ret, i, nb_started = 0;
+
+    if (argc > 1)
+        in_filename = argv[1];
+    if (argc > 2)
+        out_filename = argv[2];
+    if (argc > 3)
+        filter_descr = argv[3];
+
+    if ((ret = open_input_file(in_filename)) < 0)
+        goto end;
+    if ((ret = init_filters(filter_descr)) < 0)
+        goto end;
+
+    out_file = fopen(out_filename, "wb");
+    if (!out_file) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open %s\n", out_filename);
+        goto end;
+    }
+
+    if ((ret = alloc_queue(&packet_queue, free_packet_msg)) < 0 ||
+        (ret = alloc_queue(&frame_queue, free_frame_msg)) < 0 ||
+        (ret = alloc_queue(&filtered_queue, free_frame_msg)) < 0)
+        goto end;
+
+    start = av_gettime_relative();
+    for (i = 0; i < FF_ARRAY_ELEMS(stages); i++) {
+        ret = pthread_create(&stages[i].thread, NULL, stages[i].run, &stages[i]);
+        if (ret) {
+            fprintf(stderr, "Could not start the %s thread\n", stages[i].name);
+            ret = AVERROR(ret);
+            /* unblock the stages that are already running */
+            av_thread_message_queue_set_err_send(packet_queue, AVERROR_EXIT);
+            av_thread_message_queue_set_err_recv(packet_queue, AVERROR_EXIT);
+            av_thread_message_queue_set_err_recv(frame_queue, AVERROR_EXIT);
+            av_thread_message_queue_set_err_recv(filtered_queue, AVERROR_EXIT);
+            break;
+        }
+        nb_started++;
+    }
+    for (i = 0; i < nb_started; i++) {
+        pthread_join(stages[i].thread, NULL);
+        if (stages[i].ret < 0)
+            ret = stages[i].ret;
+    }
+    elapsed = av_gettime_relative() - start;
+
+    if (nb_started == FF_ARRAY_ELEMS(stages)) {
+        for (i = 0; i < nb_started; i++)
+            printf("%-6s %5d items, busy %8.2f ms\n", stages[i].name, stages[i].count,
+                   stages[i].busy / 1000.0);
+        printf("wall   %8.2f ms\n", elapsed / 1000.0);
+    }
+
+    end:
+    av_thread_message_queue_free(&packet_queue);
+    av_thread_message_queue_free(&frame_queue);
+    av_thread_message_queue_free(&filtered_queue);
+    avfilter_graph_free(&filter_graph);
+    avcodec_free_context(&dec_ctx);
+    avformat_close_input(&fmt_ctx);
+    if (out_file)
+        fclose(out_file);
+
+    if (ret < 0 && ret != AVERROR_EOF) {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    return 0;
+}
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -39,6 +40,10 @@
 #include <libavfilter/buffersrc.h>
 #include <libavutil/opt.h>
 
+#include "core/avio_readahead.h"
+#include "core/media_util.h"
+#include "core/stage_timer.h"
+
 //lutyuv='u=128:v=128'
 //boxblur
 //        hflip
@@ -77,14 +82,15 @@ AVFilterContext *buffersrc_ctx;
 AVFilterGraph *filter_graph;
 static int video_stream_index = -1;
 static int64_t last_pts = AV_NOPTS_VALUE;
+/* -readahead: demux through the prefetching AVIOContext */
+static int use_readahead;
 
 void save_rgb_file(AVFrame *filt_frame, FILE *out_file);
 
 static int open_input_file(const char *filename) {
     int ret;
-    AVCodec *dec;
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename, NULL, NULL)) < 0) {
+    if ((ret = avio_readahead_open_input(&fmt_ctx, filename, use_readahead)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
         return ret;
     }
@@ -94,26 +100,12 @@ static int open_input_file(const char *filename) {
         return ret;
     }
 
-    /* select the video stream */
-    ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find a video stream in the input file\n");
+    /* select the video stream and init its decoder */
+    ret = media_open_stream_decoder(fmt_ctx, AVMEDIA_TYPE_VIDEO, &dec_ctx, NULL);
+    if (ret < 0)
         return ret;
-    }
     video_stream_index = ret;
 
-    /* create decoding context */
-    dec_ctx = avcodec_alloc_context3(dec);
-    if (!dec_ctx)
-        return AVERROR(ENOMEM);
-    avcodec_parameters_to_context(dec_ctx, fmt_ctx->streams[video_stream_index]->codecpar);
-
-    /* init the video decoder */
-    if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open video decoder\n");
-        return ret;
-    }
-
     return 0;
 }
 
@@ -246,7 +238,7 @@ static void display_frame(const AVFrame *frame, AVRational time_base, FILE *fp_y
 //    fflush(stdout);
 }
 
-int main() {
+int main(int argc, char **argv) {
     int ret;
     AVPacket packet;
     AVFrame *frame;
@@ -261,6 +253,18 @@ int main() {
 
     const char *in_file = "../ds.264";
 
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-readahead")) {
+            use_readahead = 1;
+        } else if (argv[i][0] != '-') {
+            in_file = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-readahead] [input_file]\n"
+                            "-readahead reads the input ahead on a helper thread.\n", argv[0]);
+            exit(1);
+        }
+    }
+
     if ((ret = open_input_file(in_file)) < 0)
         goto end;
     if ((ret = init_filters(filter_descr)) < 0)
@@ -270,18 +274,18 @@ int main() {
     int pts = 0;
     /* read all packets */
     while (1) {
-        if ((ret = av_read_frame(fmt_ctx, &packet)) < 0)
+        if ((ret = timed_read_frame(fmt_ctx, &packet)) < 0)
             break;
 
         if (packet.stream_index == video_stream_index) {
-            ret = avcodec_send_packet(dec_ctx, &packet);
+            ret = timed_send_packet(dec_ctx, &packet);
             if (ret < 0) {
                 av_log(NULL, AV_LOG_ERROR, "Error while sending a packet to the decoder\n");
                 break;
             }
 
             while (ret >= 0) {
-                ret = avcodec_receive_frame(dec_ctx, frame);
+                ret = timed_receive_frame(dec_ctx, frame);
                 if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                     break;
                 } else if (ret < 0) {
@@ -293,14 +297,14 @@ int main() {
                 pts++;
 
                 /* push the decoded frame into the filtergraph */
-                if (av_buffersrc_add_frame_flags(buffersrc_ctx, frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {
+                if (timed_buffersrc_add_frame_flags(buffersrc_ctx, frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {
                     av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
                     break;
                 }
 
                 /* pull filtered frames from the filtergraph */
                 while (1) {
-                    ret = av_buffersink_get_frame(buffersink_ctx, filt_frame);
+                    ret = timed_buffersink_get_frame(buffersink_ctx, filt_frame);
                     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                         break;
                     if (ret < 0)
@@ -318,7 +322,7 @@ int main() {
     end:
     avfilter_graph_free(&filter_graph);
     avcodec_free_context(&dec_ctx);
-    avformat_close_input(&fmt_ctx);
+    avio_readahead_close_input(&fmt_ctx);
     av_frame_free(&frame);
     av_frame_free(&filt_frame);
     fclose(fp_yuv);
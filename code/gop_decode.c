@@ -0,0 +1,334 @@
+/**
+ * @file
+ * GOP parallel decoding of an H.264/HEVC elementary stream.
+ *
+ * Frame threading in libavcodec stops scaling after a few threads on small
+ * pictures. Here the stream is cut at its IDR (and HEVC BLA) access units
+ * with the keyframe index instead. Each segment is decoded from its own
+ * offset by a worker with its own single threaded AVCodecContext, fed with
+ * the parameter sets in effect there. The main thread writes the decoded
+ * pictures segment by segment, which gives the same order as decoding the
+ * stream from the start. HEVC CRA pictures are not used as cut points,
+ * because the pictures leading them may reference the previous GOP. The
+ * codec is detected from the start of the stream unless -codec is given.
+ *
+ * usage: gop_decode [-threads N] [-codec h264|hevc] input_file [output_file]
+ * @example gop_decode.c
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+#include <libavutil/file.h>
+#include <libavutil/time.h>
+
+#include "core/annexb.h"
+#include "core/es_index.h"
+#include "core/media_util.h"
+#include "core/stage_timer.h"
+
+/* most parameter sets fed to the decoder in front of a segment */
+#define MAX_PARAM_SETS 64
+
+/* HEVC CRA_NUT, an IRAP picture that may have RASL pictures before it */
+#define HEVC_NAL_CRA 21
+
+/* a run of GOPs starting at a keyframe, decoded by one worker */
+typedef struct Segment {
+    int64_t start;
+    int64_t end;
+    const ESParamSet *param_sets[MAX_PARAM_SETS];
+    int nb_param_sets;
+    AVFrame **frames;       ///< decoded pictures in output order
+    int nb_frames;
+    unsigned frames_allocated;
+    int ret;
+    int done;
+} Segment;
+
+/* lock protects next_segment, written, abort and the done/ret of the segments */
+typedef struct GopDecoder {
+    const AVCodec *codec;
+    const uint8_t *data;
+    Segment *segments;
+    int nb_segments;
+    int next_segment;       ///< next segment to decode
+    int written;            ///< segments handed to the output
+    int window;             ///< how many segments may be decoded ahead of the output
+    int abort;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} GopDecoder;
+
+static int store_frames(AVCodecContext *c, Segment *seg) {
+    AVFrame *frame, **frames;
+    int ret;
+
+    while (1) {
+        frame = av_frame_alloc();
+        if (!frame)
+            return AVERROR(ENOMEM);
+        ret = timed_receive_frame(c, frame);
+        if (ret < 0) {
+            av_frame_free(&frame);
+            return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+        }
+        frames = av_fast_realloc(seg->frames, &seg->frames_allocated,
+                                 (seg->nb_frames + 1) * sizeof(*frames));
+        if (!frames) {
+            av_frame_free(&frame);
+            return AVERROR(ENOMEM);
+        }
+        seg->frames = frames;
+        seg->frames[seg->nb_frames++] = frame;
+    }
+}
+
+/* split data with the parser, NULL data flushes it */
+static int parse_and_decode(AVCodecParserContext *parser, AVCodecContext *c, AVPacket *pkt,
+                            Segment *seg, const uint8_t *data, int64_t size) {
+    int ret;
+
+    do {
+        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size, data, FFMIN(size, INT_MAX),
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (ret < 0)
+            return ret;
+        data += ret;
+        size -= ret;
+
+        /* the packet points into the mapping or the parser, the decoder
+         * copies it into a padded buffer */
+        if (pkt->size) {
+            if ((ret = timed_send_packet(c, pkt)) < 0 || (ret = store_frames(c, seg)) < 0)
+                return ret;
+        }
+    } while (size > 0);
+    return 0;
+}
+
+static int decode_segment(GopDecoder *gd, AVCodecContext *c, AVPacket *pkt, Segment *seg) {
+    AVCodecParserContext *parser = av_parser_init(gd->codec->id);
+    int i, ret = 0;
+
+    if (!parser)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < seg->nb_param_sets && ret >= 0; i++)
+        ret = parse_and_decode(parser, c, pkt, seg, gd->data + seg->param_sets[i]->pos,
+                               seg->param_sets[i]->size);
+    if (ret >= 0)
+        ret = parse_and_decode(parser, c, pkt, seg, gd->data + seg->start, seg->end - seg->start);
+    if (ret >= 0)
+        ret = parse_and_decode(parser, c, pkt, seg, NULL, 0);
+    /* drain the decoder, then reset it for the next segment */
+    if (ret >= 0 && (ret = timed_send_packet(c, NULL)) >= 0)
+        ret = store_frames(c, seg);
+    avcodec_flush_buffers(c);
+    av_parser_close(parser);
+    return ret;
+}
+
+static void *worker_thread(void *arg) {
+    GopDecoder *gd = arg;
+    AVCodecContext *c = avcodec_alloc_context3(gd->codec);
+    AVPacket *pkt = av_packet_alloc();
+    Segment *seg;
+    int ret = AVERROR(ENOMEM);
+
+    if (c && pkt) {
+        /* the parallelism comes from the segments */
+        c->thread_count = 1;
+        ret = avcodec_open2(c, gd->codec, NULL);
+    }
+
+    pthread_mutex_lock(&gd->lock);
+    for (;;) {
+        while (!gd->abort && gd->next_segment < gd->nb_segments &&
+               gd->next_segment - gd->written >= gd->window)
+            pthread_cond_wait(&gd->cond, &gd->lock);
+        if (gd->abort || gd->next_segment == gd->nb_segments)
+            break;
+        seg = &gd->segments[gd->next_segment++];
+        pthread_mutex_unlock(&gd->lock);
+
+        if (ret >= 0)
+            ret = decode_segment(gd, c, pkt, seg);
+
+        pthread_mutex_lock(&gd->lock);
+        seg->ret = ret;
+        seg->done = 1;
+        pthread_cond_broadcast(&gd->cond);
+    }
+    pthread_mutex_unlock(&gd->lock);
+
+    avcodec_free_context(&c);
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+/* one segment per IDR/BLA keyframe, a CRA keyframe stays in the segment
+ * before it */
+static int init_segments(GopDecoder *gd, const ESIndex *idx) {
+    const ESIndexEntry *kf;
+    Segment *seg;
+    int i;
+
+    gd->segments = av_mallocz_array(FFMAX(idx->nb_keyframes, 1), sizeof(*gd->segments));
+    if (!gd->segments)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < idx->nb_keyframes; i++) {
+        kf = &idx->keyframes[i];
+        if (gd->nb_segments && gd->codec->id == AV_CODEC_ID_HEVC && kf->nal_type == HEVC_NAL_CRA)
+            continue;
+        if (gd->nb_segments)
+            gd->segments[gd->nb_segments - 1].end = kf->pos;
+        seg = &gd->segments[gd->nb_segments++];
+        seg->start = kf->pos;
+        seg->nb_param_sets = es_index_get_param_sets(idx, kf, seg->param_sets, MAX_PARAM_SETS);
+    }
+    if (gd->nb_segments)
+        gd->segments[gd->nb_segments - 1].end = idx->file_size;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    GopDecoder gd = {0};
+    const char *filename = NULL, *outfilename = NULL, *codec_name = NULL;
+    FILE *out = NULL;
+    ESIndex *idx = NULL;
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    pthread_t *threads;
+    Segment *seg;
+    int64_t start, nb_frames = 0;
+    int nb_threads = av_cpu_count(), nb_started = 0;
+    int i, j, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            nb_threads = FFMAX(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-codec") && i + 1 < argc) {
+            codec_name = argv[++i];
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else if (argv[i][0] != '-' && !outfilename) {
+            outfilename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    if (!filename) {
+        fprintf(stderr, "usage: %s [-threads N] [-codec h264|hevc] input_file [output_file]\n"
+                        "Decode the GOPs of an elementary stream in parallel, one decoder per\n"
+                        "thread (default one per core), and write the pictures as raw video to\n"
+                        "output_file in decoding order of the GOPs. The keyframe index is kept\n"
+                        "in input_file.idx. The codec is probed from the stream by default.\n", argv[0]);
+        return 1;
+    }
+
+    start = av_gettime_relative();
+    media_check(av_file_map(filename, &map, &map_size, 0, NULL), "Could not map the input");
+    /* a wrong codec would write a meaningless index next to the input */
+    if (codec_name)
+        gd.codec = avcodec_find_decoder_by_name(codec_name);
+    else
+        gd.codec = avcodec_find_decoder(annexb_probe(map, map_size));
+    if (!gd.codec || (gd.codec->id != AV_CODEC_ID_H264 && gd.codec->id != AV_CODEC_ID_HEVC)) {
+        if (codec_name)
+            fprintf(stderr, "Codec not found, use h264 or hevc\n");
+        else
+            fprintf(stderr, "%s is neither H.264 nor HEVC, use -codec\n", filename);
+        return 1;
+    }
+    if (outfilename)
+        out = media_fopen(outfilename, "wb");
+
+    media_check(es_index_load(&idx, filename, gd.codec->id), "Could not index the input");
+    if ((int64_t) map_size != idx->file_size) {
+        fprintf(stderr, "The index does not match %s\n", filename);
+        return 1;
+    }
+    gd.data = map;
+    media_check(init_segments(&gd, idx), "Could not split the input");
+
+    /* two segments per thread in flight keeps the workers busy while the
+     * output catches up, and bounds the decoded pictures held in memory */
+    gd.window = 2 * nb_threads;
+    threads = av_malloc_array(nb_threads, sizeof(*threads));
+    if (!threads || pthread_mutex_init(&gd.lock, NULL) || pthread_cond_init(&gd.cond, NULL)) {
+        fprintf(stderr, "Could not start the decoder threads\n");
+        return 1;
+    }
+    for (; nb_started < nb_threads; nb_started++)
+        if (pthread_create(&threads[nb_started], NULL, worker_thread, &gd))
+            break;
+    if (!nb_started) {
+        fprintf(stderr, "Could not start the decoder threads\n");
+        return 1;
+    }
+
+    ret = 0;
+    for (i = 0; i < gd.nb_segments && ret >= 0; i++) {
+        seg = &gd.segments[i];
+        pthread_mutex_lock(&gd.lock);
+        while (!seg->done)
+            pthread_cond_wait(&gd.cond, &gd.lock);
+        pthread_mutex_unlock(&gd.lock);
+
+        ret = seg->ret;
+        for (j = 0; j < seg->nb_frames; j++) {
+            if (ret >= 0 && out)
+                ret = media_write_video_frame(out, seg->frames[j]);
+            av_frame_free(&seg->frames[j]);
+        }
+        av_freep(&seg->frames);
+        nb_frames += seg->nb_frames;
+        seg->nb_frames = 0;
+
+        pthread_mutex_lock(&gd.lock);
+        gd.written++;
+        pthread_cond_broadcast(&gd.cond);
+        pthread_mutex_unlock(&gd.lock);
+    }
+
+    pthread_mutex_lock(&gd.lock);
+    gd.abort = 1;
+    pthread_cond_broadcast(&gd.cond);
+    pthread_mutex_unlock(&gd.lock);
+    for (i = 0; i < nb_started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (ret < 0) {
+        fprintf(stderr, "Error decoding %s: %s\n", filename, av_err2str(ret));
+    } else {
+        double elapsed = (av_gettime_relative() - start) / 1000000.0;
+
+        printf("decoded %"PRId64" of %"PRId64" pictures in %d segments with %d threads in %.3f s",
+               nb_frames, idx->nb_frames, gd.nb_segments, nb_started, elapsed);
+        if (elapsed > 0)
+            printf(", %.2f fps", nb_frames / elapsed);
+        printf("\n");
+    }
+
+    /* the segments the workers finished after an error */
+    for (i = 0; i < gd.nb_segments; i++) {
+        for (j = 0; j < gd.segments[i].nb_frames; j++)
+            av_frame_free(&gd.segments[i].frames[j]);
+        av_free(gd.segments[i].frames);
+    }
+    av_free(gd.segments);
+    av_free(threads);
+    pthread_cond_destroy(&gd.cond);
+    pthread_mutex_destroy(&gd.lock);
+    av_file_unmap(map, map_size);
+    es_index_free(&idx);
+    if (out)
+        fclose(out);
+    return ret < 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file
+ * Build the random access index of an H.264/HEVC elementary stream.
+ *
+ * The stream is scanned once for its IDR/IRAP access units and parameter
+ * sets, and the index is written to a sidecar file ("<input_file>.idx" by
+ * default) that decode_video -seek and the GOP parallel decoder read instead
+ * of scanning the stream again.
+ *
+ * usage: index_es [-codec h264|hevc] [-v] input_file [index_file]
+ * @example index_es.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "core/es_index.h"
+
+/* .hevc/.h265/.265 files are HEVC, anything else H.264 */
+static enum AVCodecID guess_codec(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+
+    if (ext && (!av_strcasecmp(ext, ".hevc") || !av_strcasecmp(ext, ".h265") ||
+                !av_strcasecmp(ext, ".265")))
+        return AV_CODEC_ID_HEVC;
+    return AV_CODEC_ID_H264;
+}
+
+int main(int argc, char **argv) {
+    const char *filename = NULL, *index_filename = NULL;
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    ESIndex *idx = NULL;
+    char *sidecar = NULL;
+    int64_t start, gop, max_gop = 0;
+    int i, verbose = 0, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-codec") && i + 1 < argc) {
+            i++;
+            codec_id = !strcmp(argv[i], "hevc") ? AV_CODEC_ID_HEVC :
+                       !strcmp(argv[i], "h264") ? AV_CODEC_ID_H264 : AV_CODEC_ID_NONE;
+            if (codec_id == AV_CODEC_ID_NONE) {
+                fprintf(stderr, "Unknown codec '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else if (argv[i][0] != '-' && !index_filename) {
+            index_filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    if (!filename) {
+        fprintf(stderr, "usage: %s [-codec h264|hevc] [-v] input_file [index_file]\n"
+                        "Index the IDR/IRAP access units and parameter sets of an elementary\n"
+                        "stream into index_file (default input_file.idx). The codec is guessed\n"
+                        "from the file extension, -v lists the keyframes.\n", argv[0]);
+        return 1;
+    }
+    if (codec_id == AV_CODEC_ID_NONE)
+        codec_id = guess_codec(filename);
+    if (!index_filename) {
+        sidecar = av_asprintf("%s.idx", filename);
+        if (!sidecar)
+            return 1;
+        index_filename = sidecar;
+    }
+
+    start = av_gettime_relative();
+    if ((ret = es_index_build_file(&idx, filename, codec_id)) < 0) {
+        fprintf(stderr, "Could not index %s: %s\n", filename, av_err2str(ret));
+        goto end;
+    }
+    if ((ret = es_index_write(idx, index_filename)) < 0) {
+        fprintf(stderr, "Could not write %s: %s\n", index_filename, av_err2str(ret));
+        goto end;
+    }
+
+    for (i = 0; i < idx->nb_keyframes; i++) {
+        gop = (i + 1 < idx->nb_keyframes ? idx->keyframes[i + 1].frame : idx->nb_frames) -
+              idx->keyframes[i].frame;
+        max_gop = FFMAX(max_gop, gop);
+        if (verbose)
+            printf("keyframe %4d: picture %6"PRId64" offset %10"PRId64" nal type %2d, %"PRId64" pictures\n",
+                   i, idx->keyframes[i].frame, idx->keyframes[i].pos, idx->keyframes[i].nal_type, gop);
+    }
+    printf("%s: %s, %"PRId64" bytes, %"PRId64" pictures, %d keyframes (longest GOP %"PRId64"), "
+           "%d parameter sets\n",
+           filename, avcodec_get_name(codec_id), idx->file_size, idx->nb_frames,
+           idx->nb_keyframes, max_gop, idx->nb_param_sets);
+    printf("index written to %s in %.3f ms\n", index_filename, (av_gettime_relative() - start) / 1000.0);
+
+    end:
+    es_index_free(&idx);
+    av_free(sidecar);
+    return ret < 0;
+}
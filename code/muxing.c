@@ -26,9 +26,14 @@
  *
  * Output a media file in any supported libavformat format. The default
  * codecs are used.
+ *
+ * The video and the audio encoder run on their own threads with the
+ * send/receive API and pass their packets through queues to the main thread,
+ * which interleaves them by DTS into av_interleaved_write_frame().
  * @example muxing.c
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,17 +43,32 @@
 #include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/threadmessage.h>
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 
+#include "core/avio_async_writer.h"
+#include "core/media_util.h"
+#include "core/yuv_frame_source.h"
+#include "core/stage_timer.h"
+
 #define STREAM_DURATION   20.0
 #define STREAM_FRAME_RATE 25 /* 25 images/s */
 #define STREAM_PIX_FMT    AV_PIX_FMT_YUV420P /* default pix_fmt */
 
 #define SCALE_FLAGS SWS_BICUBIC
 
+/* encoded packets waiting for the interleaver, audio packets are smaller and
+ * more frequent so the audio encoder may run further ahead */
+#define VIDEO_QUEUE_SIZE 16
+#define AUDIO_QUEUE_SIZE 64
+
+/* the output is written on a helper thread, in buffers of this size */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFERS     2
+
 // a wrapper around a single output AVStream
 typedef struct OutputStream {
     AVStream *st;
@@ -65,6 +85,16 @@ typedef struct OutputStream {
 
     struct SwsContext *sws_ctx;
     struct SwrContext *swr_ctx;
+
+    /* input of the encoder thread */
+    YUVFrameSource *yuv_src;
+    FILE *pcm_file;
+    uint8_t *audio_buff;
+    int audio_buff_size;
+
+    AVThreadMessageQueue *queue;    ///< encoded packets, to the interleaver
+    pthread_t thread;
+    int ret;                        ///< error the encoder failed with, 0 otherwise
 } OutputStream;
 
 static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt) {
@@ -84,7 +114,7 @@ static int write_frame(AVFormatContext *fmt_ctx, const AVRational *time_base, AV
 
     /* Write the compressed frame to the media file. */
     log_packet(fmt_ctx, pkt);
-    return av_interleaved_write_frame(fmt_ctx, pkt);
+    return timed_interleaved_write_frame(fmt_ctx, pkt);
 }
 
 /* Add an output stream. */
@@ -173,33 +203,6 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 /**************************************************************/
 /* audio output */
 
-static AVFrame *alloc_audio_frame(enum AVSampleFormat sample_fmt,
-                                  uint64_t channel_layout,
-                                  int sample_rate, int nb_samples) {
-    AVFrame *frame = av_frame_alloc();
-    int ret;
-
-    if (!frame) {
-        fprintf(stderr, "Error allocating an audio frame\n");
-        exit(1);
-    }
-
-    frame->format = sample_fmt;
-    frame->channel_layout = channel_layout;
-    frame->sample_rate = sample_rate;
-    frame->nb_samples = nb_samples;
-
-    if (nb_samples) {
-        ret = av_frame_get_buffer(frame, 0);
-        if (ret < 0) {
-            fprintf(stderr, "Error allocating an audio buffer\n");
-            exit(1);
-        }
-    }
-
-    return frame;
-}
-
 static void open_audio(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg) {
     AVCodecContext *c;
     int nb_samples;
@@ -228,10 +231,14 @@ static void open_audio(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
     else
         nb_samples = c->frame_size;
 
-    ost->frame = alloc_audio_frame(c->sample_fmt, c->channel_layout,
-                                   c->sample_rate, nb_samples);
-    ost->tmp_frame = alloc_audio_frame(AV_SAMPLE_FMT_S16, c->channel_layout,
-                                       c->sample_rate, nb_samples);
+    ost->frame = media_alloc_audio_frame(c->sample_fmt, c->channel_layout,
+                                         c->sample_rate, nb_samples);
+    ost->tmp_frame = media_alloc_audio_frame(AV_SAMPLE_FMT_S16, c->channel_layout,
+                                             c->sample_rate, nb_samples);
+    if (!ost->frame || !ost->tmp_frame) {
+        fprintf(stderr, "Error allocating an audio frame\n");
+        exit(1);
+    }
 
     /* copy the stream parameters to the muxer */
     ret = avcodec_parameters_from_context(ost->st->codecpar, c);
@@ -262,71 +269,23 @@ static void open_audio(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
     }
 }
 
-/*
- * encode one audio frame and send it to the muxer
- * return 1 when encoding is finished, 0 otherwise
- */
-static int write_audio_frame(AVFormatContext *oc, OutputStream *ost, int size, FILE *pcm_file, uint8_t *audio_buff) {
-    if (feof(pcm_file)) {
-        return 1;
-    }
-    if (fread(audio_buff, 1, size, pcm_file) < 0) {
-        return 1;
-    }
-    AVCodecContext *c;
-    AVPacket pkt = {0}; // data and size must be 0;
+/* the next frame of raw samples, NULL at the end of the input */
+static AVFrame *get_audio_frame(OutputStream *ost) {
     AVFrame *frame = ost->frame;
-    int ret;
-    int got_packet;
-    av_init_packet(&pkt);
-    c = ost->enc;
 
-    frame->data[0] = audio_buff;
+    /* a partial frame at the end of the file is dropped */
+    if (fread(ost->audio_buff, 1, ost->audio_buff_size, ost->pcm_file) != (size_t) ost->audio_buff_size)
+        return NULL;
+
+    frame->data[0] = ost->audio_buff;
     frame->pts = ost->next_pts;
     ost->next_pts += frame->nb_samples;
-    ret = avcodec_encode_audio2(c, &pkt, frame, &got_packet);
-    if (ret < 0) {
-        fprintf(stderr, "Error encoding audio frame: %s\n", av_err2str(ret));
-        exit(1);
-    }
-
-    if (got_packet) {
-        ret = write_frame(oc, &c->time_base, ost->st, &pkt);
-        if (ret < 0) {
-            fprintf(stderr, "Error while writing audio frame: %s\n",
-                    av_err2str(ret));
-            exit(1);
-        }
-    }
-
-    return (frame || got_packet) ? 0 : 1;
+    return frame;
 }
 
 /**************************************************************/
 /* video output */
 
-static AVFrame *alloc_picture(enum AVPixelFormat pix_fmt, int width, int height) {
-    AVFrame *picture;
-    int ret;
-
-    picture = av_frame_alloc();
-    if (!picture)
-        return NULL;
-
-    picture->format = pix_fmt;
-    picture->width = width;
-    picture->height = height;
-
-    /* allocate the buffers for the frame data */
-    ret = av_frame_get_buffer(picture, 32);
-    if (ret < 0) {
-        fprintf(stderr, "Could not allocate frame data.\n");
-        exit(1);
-    }
-
-    return picture;
-}
-
 static void open_video(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg) {
     int ret;
     AVCodecContext *c = ost->enc;
@@ -342,8 +301,9 @@ static void open_video(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
         exit(1);
     }
 
-    /* allocate and init a re-usable frame */
-    ost->frame = alloc_picture(c->pix_fmt, c->width, c->height);
+    /* the frame only holds a reference to the pooled picture of the
+     * YUVFrameSource, its buffers are attached in get_video_frame() */
+    ost->frame = av_frame_alloc();
     if (!ost->frame) {
         fprintf(stderr, "Could not allocate video frame\n");
         exit(1);
@@ -354,7 +314,7 @@ static void open_video(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
      * output format. */
     ost->tmp_frame = NULL;
     if (c->pix_fmt != AV_PIX_FMT_YUV420P) {
-        ost->tmp_frame = alloc_picture(AV_PIX_FMT_YUV420P, c->width, c->height);
+        ost->tmp_frame = media_alloc_video_frame(AV_PIX_FMT_YUV420P, c->width, c->height, 32);
         if (!ost->tmp_frame) {
             fprintf(stderr, "Could not allocate temporary picture\n");
             exit(1);
@@ -369,11 +329,9 @@ static void open_video(AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
     }
 }
 
-static AVFrame *get_video_frame(OutputStream *ost, FILE *yuv_file, uint8_t *picture_buf) {
-    if (feof(yuv_file)) {
-        return NULL;
-    }
+static AVFrame *get_video_frame(OutputStream *ost, YUVFrameSource *yuv_src) {
     AVCodecContext *c = ost->enc;
+    int ret;
 
     /* check if we want to generate more frames */
     if (av_compare_ts(ost->next_pts, c->time_base,
@@ -381,61 +339,126 @@ static AVFrame *get_video_frame(OutputStream *ost, FILE *yuv_file, uint8_t *pict
         return NULL;
 
     /* when we pass a frame to the encoder, it may keep a reference to it
-     * internally; make sure we do not overwrite it here */
-    if (av_frame_make_writable(ost->frame) < 0)
-        exit(1);
-
-    //像素缓冲区
-    av_image_fill_arrays(ost->frame->data, ost->frame->linesize, picture_buf, c->pix_fmt, c->width,
-                         c->height, 1);
-    int y_size = c->width * c->height;
-    if (fread(picture_buf, 1, y_size * 3 / 2, yuv_file) < 0) {
-        printf("Failed to read raw data! \n");
+     * internally; dropping ours and reading into a new pooled buffer makes
+     * sure we do not overwrite it here */
+    av_frame_unref(ost->frame);
+    ret = yuv_frame_source_read(yuv_src, ost->frame);
+    if (ret < 0) {
+        if (ret != AVERROR_EOF)
+            printf("Failed to read raw data! \n");
         return NULL;
     }
-    ost->frame->data[0] = picture_buf;              // Y
-    ost->frame->data[1] = picture_buf + y_size;      // U
-    ost->frame->data[2] = picture_buf + y_size * 5 / 4;  // V
     ost->frame->pts = ost->next_pts++;
     return ost->frame;
 }
 
-/*
- * encode one video frame and send it to the muxer
- * return 1 when encoding is finished, 0 otherwise
- */
-static int write_video_frame(AVFormatContext *oc, OutputStream *ost, FILE *yuv_file, uint8_t *picture_buf) {
-    int ret;
-    AVCodecContext *c;
-    AVFrame *frame;
-    int got_packet = 0;
-    AVPacket pkt = {0};
+/**************************************************************/
+/* encoder threads */
 
-    c = ost->enc;
+static void free_packet_msg(void *msg) {
+    av_packet_free((AVPacket **) msg);
+}
 
-    frame = get_video_frame(ost, yuv_file, picture_buf);
+/* encode one frame, NULL to flush, and queue the packets it completes */
+static int encode_frame(OutputStream *ost, AVFrame *frame) {
+    AVPacket *pkt;
+    int ret;
 
-    av_init_packet(&pkt);
+    ret = timed_send_frame(ost->enc, frame);
+    if (ret < 0)
+        return ret;
 
-    /* encode the image */
-    ret = avcodec_encode_video2(c, &pkt, frame, &got_packet);
-    if (ret < 0) {
-        fprintf(stderr, "Error encoding video frame: %s\n", av_err2str(ret));
-        exit(1);
+    while (1) {
+        pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
+        ret = timed_receive_packet(ost->enc, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return ret == AVERROR(EAGAIN) ? 0 : ret;
+        }
+        /* blocks while the interleaver waits for the other stream */
+        ret = av_thread_message_queue_send(ost->queue, &pkt, 0);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return ret;
+        }
     }
+}
 
-    if (got_packet) {
-        ret = write_frame(oc, &c->time_base, ost->st, &pkt);
-    } else {
-        ret = 0;
+static void *encode_thread(void *arg) {
+    OutputStream *ost = arg;
+    AVFrame *frame;
+    int ret = 0;
+
+    while (ret >= 0) {
+        if (ost->enc->codec_type == AVMEDIA_TYPE_VIDEO)
+            frame = get_video_frame(ost, ost->yuv_src);
+        else
+            frame = get_audio_frame(ost);
+        ret = encode_frame(ost, frame);
+        if (!frame)
+            break;
     }
 
-    if (ret < 0) {
-        fprintf(stderr, "Error while writing video frame: %s\n", av_err2str(ret));
+    if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT) {
+        fprintf(stderr, "Error encoding %s frame: %s\n",
+                av_get_media_type_string(ost->enc->codec_type), av_err2str(ret));
+        ost->ret = ret;
+    }
+    av_thread_message_queue_set_err_recv(ost->queue, ost->ret ? AVERROR_EXIT : AVERROR_EOF);
+    return NULL;
+}
+
+static void start_encoder(OutputStream *ost, int queue_size) {
+    if (av_thread_message_queue_alloc(&ost->queue, queue_size, sizeof(AVPacket *)) < 0) {
+        fprintf(stderr, "Could not allocate the packet queue\n");
         exit(1);
     }
+    av_thread_message_queue_set_free_func(ost->queue, free_packet_msg);
+    if (pthread_create(&ost->thread, NULL, encode_thread, ost)) {
+        fprintf(stderr, "Could not start the encoder thread\n");
+        exit(1);
+    }
+}
+
+/* each encoder queues its packets in DTS order, so always writing the
+ * earliest of the packets at the head of the queues interleaves the
+ * streams; the interleaver waits for a packet of every unfinished stream */
+static int interleave_packets(AVFormatContext *oc, OutputStream **streams, int nb_streams) {
+    AVPacket *pending[2] = {NULL};
+    int done[2] = {0};
+    int i, next, ret = 0;
+
+    while (ret >= 0) {
+        next = -1;
+        for (i = 0; i < nb_streams; i++) {
+            if (!done[i] && !pending[i]) {
+                ret = av_thread_message_queue_recv(streams[i]->queue, &pending[i], 0);
+                if (ret == AVERROR_EOF) {
+                    done[i] = 1;
+                    ret = 0;
+                } else if (ret < 0) {
+                    break;
+                }
+            }
+            if (pending[i] &&
+                (next < 0 || av_compare_ts(pending[i]->dts, streams[i]->enc->time_base,
+                                           pending[next]->dts, streams[next]->enc->time_base) < 0))
+                next = i;
+        }
+        if (ret < 0 || next < 0)
+            break;
+
+        ret = write_frame(oc, &streams[next]->enc->time_base, streams[next]->st, pending[next]);
+        av_packet_free(&pending[next]);
+        if (ret < 0)
+            fprintf(stderr, "Error while writing output packet: %s\n", av_err2str(ret));
+    }
 
-    return (frame || got_packet) ? 0 : 1;
+    for (i = 0; i < nb_streams; i++)
+        av_packet_free(&pending[i]);
+    return ret;
 }
 
 static void close_stream(AVFormatContext *oc, OutputStream *ost) {
@@ -444,6 +467,7 @@ static void close_stream(AVFormatContext *oc, OutputStream *ost) {
     av_frame_free(&ost->tmp_frame);
     sws_freeContext(ost->sws_ctx);
     swr_free(&ost->swr_ctx);
+    av_thread_message_queue_free(&ost->queue);
 }
 
 /**************************************************************/
@@ -451,11 +475,11 @@ static void close_stream(AVFormatContext *oc, OutputStream *ost) {
 
 int main() {
     OutputStream video_st = {0}, audio_st = {0};
+    OutputStream *streams[2] = {&video_st, &audio_st};
     AVOutputFormat *fmt;
     AVFormatContext *oc;
     AVCodec *audio_codec, *video_codec;
-    int ret;
-    int encode_video = 1, encode_audio = 1;
+    int i, ret;
     AVDictionary *opt = NULL;
 
     const char *filename = "../muxing.flv";
@@ -481,7 +505,7 @@ int main() {
 
     /* open the output file, if needed */
     if (!(fmt->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&oc->pb, filename, AVIO_FLAG_WRITE);
+        ret = avio_async_writer_open(&oc->pb, filename, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFERS);
         if (ret < 0) {
             fprintf(stderr, "Could not open '%s': %s\n", filename,
                     av_err2str(ret));
@@ -497,40 +521,54 @@ int main() {
         return 1;
     }
 
-    int picture_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 480, 272, 1);
-    uint8_t *picture_buf = (uint8_t *) av_malloc(picture_size);
-    FILE *yuv_file = fopen("../ds_480x272.yuv", "rb");
-
-
-    int size = av_samples_get_buffer_size(NULL, audio_st.enc->channels, audio_st.enc->frame_size,
-                                          audio_st.enc->sample_fmt, 1);
-    uint8_t *audio_buff = (uint8_t *) av_malloc(size);
-    FILE *pcm_file = fopen("../origin.pcm", "rb");
-    while (encode_video || encode_audio) {
-        /* select the stream to encode */
-        if (encode_video &&
-            (!encode_audio || av_compare_ts(video_st.next_pts, video_st.enc->time_base,
-                                            audio_st.next_pts, audio_st.enc->time_base) <= 0)) {
-            encode_video = !write_video_frame(oc, &video_st, yuv_file, picture_buf);
-        } else {
-            encode_audio = !write_audio_frame(oc, &audio_st, size, pcm_file, audio_buff);
-        }
+    video_st.yuv_src = yuv_frame_source_open("../ds_480x272.yuv", video_st.enc->pix_fmt,
+                                             video_st.enc->width, video_st.enc->height, 32);
+    if (!video_st.yuv_src) {
+        fprintf(stderr, "Could not open the raw video input\n");
+        return 1;
     }
 
+    audio_st.audio_buff_size = av_samples_get_buffer_size(NULL, audio_st.enc->channels,
+                                                          audio_st.enc->frame_size,
+                                                          audio_st.enc->sample_fmt, 1);
+    audio_st.audio_buff = (uint8_t *) av_malloc(audio_st.audio_buff_size);
+    audio_st.pcm_file = media_fopen("../origin.pcm", "rb");
+
+    start_encoder(&video_st, VIDEO_QUEUE_SIZE);
+    start_encoder(&audio_st, AUDIO_QUEUE_SIZE);
+
+    ret = interleave_packets(oc, streams, 2);
+    if (ret < 0) {
+        /* unblock the encoders and drop what they queued */
+        for (i = 0; i < 2; i++)
+            av_thread_message_queue_set_err_send(streams[i]->queue, AVERROR_EXIT);
+    }
+    for (i = 0; i < 2; i++)
+        pthread_join(streams[i]->thread, NULL);
+    if (ret < 0 || video_st.ret < 0 || audio_st.ret < 0)
+        return 1;
+
     /* Write the trailer, if any. The trailer must be written before you
      * close the CodecContexts open when you wrote the header; otherwise
      * av_write_trailer() may try to use memory that was freed on
      * av_codec_close(). */
     av_write_trailer(oc);
-    fclose(yuv_file);
 
     /* Close each codec. */
     close_stream(oc, &video_st);
     close_stream(oc, &audio_st);
+    yuv_frame_source_close(&video_st.yuv_src);
+    fclose(audio_st.pcm_file);
+    av_free(audio_st.audio_buff);
 
-    if (!(fmt->flags & AVFMT_NOFILE))
-        /* Close the output file. */
-        avio_closep(&oc->pb);
+    if (!(fmt->flags & AVFMT_NOFILE)) {
+        /* Close the output file, this waits for the last buffers to be written. */
+        ret = avio_async_writer_close(&oc->pb);
+        if (ret < 0) {
+            fprintf(stderr, "Error writing '%s': %s\n", filename, av_err2str(ret));
+            return 1;
+        }
+    }
 
     /* free the stream */
     avformat_free_context(oc);
@@ -0,0 +1,187 @@
+/**
+ * @file
+ * Demuxing through the readahead AVIOContext.
+ *
+ * The input file is read through a custom AVIOContext that sleeps before
+ * every read, a stand-in for slow storage. It is demuxed twice, once reading
+ * the slow source directly on the demux thread and once through
+ * avio_readahead, with a fixed amount of simulated decoding work per packet,
+ * and the wall time of both runs is printed.
+ *
+ * usage: readahead_demux [-delay US] [-work US] [-block N] [-window N] [input_file]
+ * @example readahead_demux.c
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavutil/time.h>
+
+#include "core/avio_readahead.h"
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+/* a local file that takes delay microseconds to answer every read */
+typedef struct SlowFile {
+    FILE *f;
+    int64_t size;
+    int delay;
+} SlowFile;
+
+static int slow_read(void *opaque, uint8_t *buf, int buf_size) {
+    SlowFile *sf = opaque;
+    size_t n;
+
+    av_usleep(sf->delay);
+    n = fread(buf, 1, buf_size, sf->f);
+    if (!n)
+        return ferror(sf->f) ? AVERROR(EIO) : AVERROR_EOF;
+    return n;
+}
+
+static int64_t slow_seek(void *opaque, int64_t offset, int whence) {
+    SlowFile *sf = opaque;
+
+    if (whence == AVSEEK_SIZE)
+        return sf->size;
+    if (fseeko(sf->f, offset, whence & ~AVSEEK_FORCE) < 0)
+        return AVERROR(errno);
+    return ftello(sf->f);
+}
+
+static int open_slow_file(AVIOContext **pb, SlowFile *sf, const char *filename,
+                          int delay, int block_size) {
+    uint8_t *buffer;
+
+    sf->f = fopen(filename, "rb");
+    if (!sf->f) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return AVERROR(errno);
+    }
+    fseeko(sf->f, 0, SEEK_END);
+    sf->size = ftello(sf->f);
+    fseeko(sf->f, 0, SEEK_SET);
+    sf->delay = delay;
+
+    buffer = av_malloc(block_size);
+    if (!buffer)
+        return AVERROR(ENOMEM);
+    *pb = avio_alloc_context(buffer, block_size, 0, sf, slow_read, NULL, slow_seek);
+    if (!*pb) {
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static void close_slow_file(AVIOContext **pb, SlowFile *sf) {
+    if (*pb)
+        av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+    if (sf->f)
+        fclose(sf->f);
+    sf->f = NULL;
+}
+
+/* demux everything from pb, sleeping work microseconds per packet in place
+ * of the decoder */
+static int demux(AVIOContext *pb, int work, int *nb_packets) {
+    AVFormatContext *fmt_ctx = avformat_alloc_context();
+    AVPacket pkt;
+    int ret;
+
+    if (!fmt_ctx)
+        return AVERROR(ENOMEM);
+    fmt_ctx->pb = pb;
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    *nb_packets = 0;
+    if ((ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open input\n");
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) >= 0) {
+        while ((ret = av_read_frame(fmt_ctx, &pkt)) >= 0) {
+            av_packet_unref(&pkt);
+            (*nb_packets)++;
+            av_usleep(work);
+        }
+    }
+    avformat_close_input(&fmt_ctx);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int main(int argc, char **argv) {
+    const char *filename = "../ds.264";
+    int delay = 2000, work = 500, block_size = 65536, window = 8;
+    AVIOContext *slow_pb = NULL, *pb = NULL;
+    AVIOReadaheadStats stats;
+    SlowFile sf = {0};
+    int64_t start, plain_time, readahead_time;
+    int i, nb_packets, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-delay") && i + 1 < argc) {
+            delay = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-work") && i + 1 < argc) {
+            work = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-block") && i + 1 < argc) {
+            block_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-window") && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-delay US] [-work US] [-block N] [-window N] [input_file]\n"
+                            "-delay is the latency of every read from the file (default %d us),\n"
+                            "-work the time spent on every packet (default %d us),\n"
+                            "-block and -window the readahead block size and number of blocks.\n",
+                    argv[0], delay, work);
+            return 1;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    /* every read goes to the slow file on the demux thread */
+    if ((ret = open_slow_file(&slow_pb, &sf, filename, delay, block_size)) < 0)
+        goto end;
+    start = av_gettime_relative();
+    ret = demux(slow_pb, work, &nb_packets);
+    plain_time = av_gettime_relative() - start;
+    close_slow_file(&slow_pb, &sf);
+    if (ret < 0)
+        goto end;
+    printf("plain:     %d packets in %.3f s\n", nb_packets, plain_time / 1e6);
+
+    /* the same file, read ahead on the helper thread */
+    if ((ret = open_slow_file(&slow_pb, &sf, filename, delay, block_size)) < 0 ||
+        (ret = avio_readahead_wrap(&pb, slow_pb, block_size, window)) < 0)
+        goto end;
+    start = av_gettime_relative();
+    ret = demux(pb, work, &nb_packets);
+    readahead_time = av_gettime_relative() - start;
+    if (ret < 0)
+        goto end;
+    avio_readahead_get_stats(pb, &stats);
+    printf("readahead: %d packets in %.3f s, %"PRId64" blocks, %"PRId64" stalls (%.3f s), "
+           "%"PRId64" blocks dropped by seeks\n",
+           nb_packets, readahead_time / 1e6, stats.blocks, stats.stalls,
+           stats.stall_time / 1e6, stats.discarded);
+    if (readahead_time > 0)
+        printf("speedup:   %.2fx\n", (double) plain_time / readahead_time);
+
+    end:
+    avio_readahead_close(&pb);
+    close_slow_file(&slow_pb, &sf);
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+    return 0;
+}
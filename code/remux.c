@@ -0,0 +1,195 @@
+/**
+ * @file
+ * Stream copy of an H.264/HEVC elementary stream into a container.
+ *
+ * The Annex B input (ds.264, ds.hevc) is split into access units by the raw
+ * demuxer and its parser; the parameter sets found at the start of the stream
+ * become the extradata of the output stream, and the timestamps are generated
+ * from the frame rate. The packets are then written to MP4, FLV or MPEG-TS
+ * without being decoded, so the run takes about as long as reading the input
+ * and writing the output.
+ *
+ * usage: remux [-framerate N] input_file output_file
+ * @example remux.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/parseutils.h>
+#include <libavutil/time.h>
+
+#include "core/avio_async_writer.h"
+#include "core/stage_timer.h"
+
+/* the output is written on a helper thread, in buffers of this size */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFERS     2
+
+static int open_input(AVFormatContext **ifmt_ctx, const char *filename, const char *framerate) {
+    AVDictionary *opts = NULL;
+    AVCodecParameters *par;
+    int ret;
+
+    /* the raw demuxers take the frame rate of an elementary stream as an
+     * option, it is the only source of timing the stream has */
+    av_dict_set(&opts, "framerate", framerate, 0);
+    *ifmt_ctx = avformat_alloc_context();
+    if (!*ifmt_ctx)
+        return AVERROR(ENOMEM);
+    (*ifmt_ctx)->flags |= AVFMT_FLAG_GENPTS;
+    ret = avformat_open_input(ifmt_ctx, filename, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Could not open input file '%s'\n", filename);
+        return ret;
+    }
+
+    /* also extracts the parameter sets into the extradata */
+    if ((ret = avformat_find_stream_info(*ifmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Failed to retrieve input stream information\n");
+        return ret;
+    }
+
+    par = (*ifmt_ctx)->streams[0]->codecpar;
+    if ((*ifmt_ctx)->nb_streams != 1 ||
+        (par->codec_id != AV_CODEC_ID_H264 && par->codec_id != AV_CODEC_ID_HEVC)) {
+        fprintf(stderr, "'%s' is not an H.264 or HEVC elementary stream\n", filename);
+        return AVERROR(EINVAL);
+    }
+    if (!par->extradata_size) {
+        fprintf(stderr, "No parameter sets found at the start of '%s'\n", filename);
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static int open_output(AVFormatContext **ofmt_ctx, const char *filename, AVStream *in_stream,
+                       AVRational frame_rate) {
+    AVStream *out_stream;
+    int ret;
+
+    avformat_alloc_output_context2(ofmt_ctx, NULL, NULL, filename);
+    if (!*ofmt_ctx) {
+        fprintf(stderr, "Could not deduce output format from file extension: %s\n", filename);
+        return AVERROR(EINVAL);
+    }
+
+    /* FLV has no codec id for HEVC */
+    if (in_stream->codecpar->codec_id == AV_CODEC_ID_HEVC &&
+        !strcmp((*ofmt_ctx)->oformat->name, "flv")) {
+        fprintf(stderr, "HEVC cannot be stored in FLV, use MP4 or MPEG-TS\n");
+        return AVERROR(EINVAL);
+    }
+
+    out_stream = avformat_new_stream(*ofmt_ctx, NULL);
+    if (!out_stream)
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar)) < 0)
+        return ret;
+    /* the muxer picks the tag, and converts the Annex B extradata and
+     * packets to length prefixed NAL units where the container needs it */
+    out_stream->codecpar->codec_tag = 0;
+    out_stream->avg_frame_rate = frame_rate;
+    out_stream->time_base = av_inv_q(frame_rate);
+
+    if (!((*ofmt_ctx)->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_async_writer_open(&(*ofmt_ctx)->pb, filename, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFERS);
+        if (ret < 0) {
+            fprintf(stderr, "Could not open output file '%s'\n", filename);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
+    AVStream *in_stream, *out_stream;
+    AVPacket pkt;
+    const char *framerate = "25";
+    AVRational frame_rate;
+    const char *in_filename = NULL, *out_filename = NULL;
+    int64_t frame_duration, next_dts = 0, nb_packets = 0, start;
+    int i, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-framerate") && i + 1 < argc) {
+            framerate = argv[++i];
+        } else if (argv[i][0] == '-' || (in_filename && out_filename)) {
+            in_filename = NULL;
+            break;
+        } else if (!in_filename) {
+            in_filename = argv[i];
+        } else {
+            out_filename = argv[i];
+        }
+    }
+    if (!in_filename || !out_filename || av_parse_video_rate(&frame_rate, framerate) < 0) {
+        fprintf(stderr, "usage: %s [-framerate N] input_file output_file\n"
+                        "Copy an H.264/HEVC elementary stream into MP4, FLV or MPEG-TS without\n"
+                        "decoding it. The output format is guessed from the file extension, the\n"
+                        "frame rate (default 25) gives the timestamps.\n", argv[0]);
+        return 1;
+    }
+
+    start = av_gettime_relative();
+    if ((ret = open_input(&ifmt_ctx, in_filename, framerate)) < 0)
+        goto end;
+    in_stream = ifmt_ctx->streams[0];
+    if ((ret = open_output(&ofmt_ctx, out_filename, in_stream, frame_rate)) < 0)
+        goto end;
+    out_stream = ofmt_ctx->streams[0];
+    av_dump_format(ofmt_ctx, 0, out_filename, 1);
+
+    if ((ret = avformat_write_header(ofmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Error occurred when opening output file\n");
+        goto end;
+    }
+
+    frame_duration = av_rescale_q(1, av_inv_q(frame_rate), in_stream->time_base);
+    while ((ret = timed_read_frame(ifmt_ctx, &pkt)) >= 0) {
+        /* the parser may leave the timestamps of a stream without B-frames
+         * unset, they are then one frame apart in decoding order */
+        if (pkt.dts == AV_NOPTS_VALUE)
+            pkt.dts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : next_dts;
+        if (pkt.pts == AV_NOPTS_VALUE)
+            pkt.pts = pkt.dts;
+        if (!pkt.duration)
+            pkt.duration = frame_duration;
+        next_dts = pkt.dts + pkt.duration;
+
+        av_packet_rescale_ts(&pkt, in_stream->time_base, out_stream->time_base);
+        pkt.stream_index = 0;
+        pkt.pos = -1;
+        ret = timed_interleaved_write_frame(ofmt_ctx, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error muxing packet\n");
+            goto end;
+        }
+        nb_packets++;
+    }
+    if (ret != AVERROR_EOF)
+        goto end;
+
+    ret = av_write_trailer(ofmt_ctx);
+    if (ret >= 0 && !(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+        ret = avio_async_writer_close(&ofmt_ctx->pb);
+    if (ret >= 0)
+        printf("%"PRId64" packets copied in %.3f s\n", nb_packets, (av_gettime_relative() - start) / 1e6);
+
+    end:
+    avformat_close_input(&ifmt_ctx);
+    if (ofmt_ctx && !(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+        avio_async_writer_close(&ofmt_ctx->pb);
+    avformat_free_context(ofmt_ctx);
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+    return 0;
+}
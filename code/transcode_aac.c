@@ -29,6 +29,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
@@ -43,6 +44,9 @@
 
 #include "libswresample/swresample.h"
 
+#include "core/avio_readahead.h"
+#include "core/stage_timer.h"
+
 /* The output bit rate in bit/s */
 #define OUTPUT_BIT_RATE 96000
 /* The number of output channels */
@@ -51,11 +55,12 @@
 /**
  * Open an input file and the required decoder.
  * @param      filename             File to be opened
+ * @param      readahead            Read the file ahead on a helper thread
  * @param[out] input_format_context Format context of opened file
  * @param[out] input_codec_context  Codec context of opened file
  * @return Error code (0 if successful)
  */
-static int open_input_file(const char *filename,
+static int open_input_file(const char *filename, int readahead,
                            AVFormatContext **input_format_context,
                            AVCodecContext **input_codec_context)
 {
@@ -64,8 +69,8 @@ static int open_input_file(const char *filename,
     int error;
 
     /* Open the input file to read from it. */
-    if ((error = avformat_open_input(input_format_context, filename, NULL,
-                                     NULL)) < 0) {
+    if ((error = avio_readahead_open_input(input_format_context, filename,
+                                           readahead)) < 0) {
         fprintf(stderr, "Could not open input file '%s' (error '%s')\n",
                 filename, av_err2str(error));
         *input_format_context = NULL;
@@ -76,7 +81,7 @@ static int open_input_file(const char *filename,
     if ((error = avformat_find_stream_info(*input_format_context, NULL)) < 0) {
         fprintf(stderr, "Could not open find stream info (error '%s')\n",
                 av_err2str(error));
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         return error;
     }
 
@@ -84,14 +89,14 @@ static int open_input_file(const char *filename,
     if ((*input_format_context)->nb_streams != 1) {
         fprintf(stderr, "Expected one audio input stream, but found %d\n",
                 (*input_format_context)->nb_streams);
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         return AVERROR_EXIT;
     }
 
     /* Find a decoder for the audio stream. */
     if (!(input_codec = avcodec_find_decoder((*input_format_context)->streams[0]->codecpar->codec_id))) {
         fprintf(stderr, "Could not find input codec\n");
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         return AVERROR_EXIT;
     }
 
@@ -99,14 +104,14 @@ static int open_input_file(const char *filename,
     avctx = avcodec_alloc_context3(input_codec);
     if (!avctx) {
         fprintf(stderr, "Could not allocate a decoding context\n");
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         return AVERROR(ENOMEM);
     }
 
     /* Initialize the stream parameters with demuxer information. */
     error = avcodec_parameters_to_context(avctx, (*input_format_context)->streams[0]->codecpar);
     if (error < 0) {
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         avcodec_free_context(&avctx);
         return error;
     }
@@ -116,7 +121,7 @@ static int open_input_file(const char *filename,
         fprintf(stderr, "Could not open input codec (error '%s')\n",
                 av_err2str(error));
         avcodec_free_context(&avctx);
-        avformat_close_input(input_format_context);
+        avio_readahead_close_input(input_format_context);
         return error;
     }
 
@@ -376,7 +381,7 @@ static int decode_audio_frame(AVFrame *frame,
     init_packet(&input_packet);
 
     /* Read one audio frame from the input file into a temporary packet. */
-    if ((error = av_read_frame(input_format_context, &input_packet)) < 0) {
+    if ((error = timed_read_frame(input_format_context, &input_packet)) < 0) {
         /* If we are at the end of the file, flush the decoder below. */
         if (error == AVERROR_EOF)
             *finished = 1;
@@ -389,14 +394,14 @@ static int decode_audio_frame(AVFrame *frame,
 
     /* Send the audio frame stored in the temporary packet to the decoder.
      * The input audio stream decoder is used to do this. */
-    if ((error = avcodec_send_packet(input_codec_context, &input_packet)) < 0) {
+    if ((error = timed_send_packet(input_codec_context, &input_packet)) < 0) {
         fprintf(stderr, "Could not send packet for decoding (error '%s')\n",
                 av_err2str(error));
         return error;
     }
 
     /* Receive one frame from the decoder. */
-    error = avcodec_receive_frame(input_codec_context, frame);
+    error = timed_receive_frame(input_codec_context, frame);
     /* If the decoder asks for more data to be able to decode a frame,
      * return indicating that no data is present. */
     if (error == AVERROR(EAGAIN)) {
@@ -673,7 +678,7 @@ static int encode_audio_frame(AVFrame *frame,
 
     /* Send the audio frame stored in the temporary packet to the encoder.
      * The output audio stream encoder is used to do this. */
-    error = avcodec_send_frame(output_codec_context, frame);
+    error = timed_send_frame(output_codec_context, frame);
     /* The encoder signals that it has nothing more to encode. */
     if (error == AVERROR_EOF) {
         error = 0;
@@ -685,7 +690,7 @@ static int encode_audio_frame(AVFrame *frame,
     }
 
     /* Receive one encoded frame from the encoder. */
-    error = avcodec_receive_packet(output_codec_context, &output_packet);
+    error = timed_receive_packet(output_codec_context, &output_packet);
     /* If the encoder asks for more data to be able to provide an
      * encoded frame, return indicating that no data is present. */
     if (error == AVERROR(EAGAIN)) {
@@ -706,7 +711,7 @@ static int encode_audio_frame(AVFrame *frame,
 
     /* Write one audio frame from the temporary packet to the output file. */
     if (*data_present &&
-        (error = av_write_frame(output_format_context, &output_packet)) < 0) {
+        (error = timed_write_frame(output_format_context, &output_packet)) < 0) {
         fprintf(stderr, "Could not write frame (error '%s')\n",
                 av_err2str(error));
         goto cleanup;
@@ -782,15 +787,21 @@ int main(int argc, char **argv)
     AVCodecContext *input_codec_context = NULL, *output_codec_context = NULL;
     SwrContext *resample_context = NULL;
     AVAudioFifo *fifo = NULL;
-    int ret = AVERROR_EXIT;
+    int ret = AVERROR_EXIT, readahead = 0;
 
+    /* -readahead demuxes through the prefetching AVIOContext. */
+    if (argc == 4 && !strcmp(argv[1], "-readahead")) {
+        readahead = 1;
+        argc--;
+        argv++;
+    }
     if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-readahead] <input file> <output file>\n", argv[0]);
         exit(1);
     }
 
     /* Open the input file for reading. */
-    if (open_input_file(argv[1], &input_format_context,
+    if (open_input_file(argv[1], readahead, &input_format_context,
                         &input_codec_context))
         goto cleanup;
     /* Open the output file for writing. */
@@ -879,7 +890,7 @@ cleanup:
     if (input_codec_context)
         avcodec_free_context(&input_codec_context);
     if (input_format_context)
-        avformat_close_input(&input_format_context);
+        avio_readahead_close_input(&input_format_context);
 
     return ret;
 }